@@ -0,0 +1,45 @@
+#[=======================================================================[.rst:
+
+EmbedSPIRV
+----------
+
+Generate a header embedding the telescope shaders, run in script mode:
+
+    cmake -DSHADER_DIR=<dir> -DSPIRV_DIR=<dir> -DSHADERS=<a.vert,b.frag> -DOUTPUT=<header> -P EmbedSPIRV.cmake
+
+For each shader ``name.kind`` in SHADERS, the header defines the GLSL
+source as ``TS_GLSL_name_kind`` and, if SPIRV_DIR is not empty, the
+SPIR-V read from ``SPIRV_DIR/name.kind.spv`` as ``TS_SPIRV_name_kind``.
+``TS_EMBEDDED_SPIRV`` tells whether the SPIR-V arrays are present.
+
+#]=======================================================================]
+
+# lists can not be passed on the command line, shaders are separated by commas
+string(REPLACE "," ";" SHADERS "${SHADERS}")
+
+set(content "// generated by cmake/EmbedSPIRV.cmake, do not edit\n\n#pragma once\n\n#include <cstdint>\n\n")
+
+if (SPIRV_DIR)
+    string(APPEND content "#define TS_EMBEDDED_SPIRV 1\n\n")
+else()
+    string(APPEND content "#define TS_EMBEDDED_SPIRV 0\n\n")
+endif()
+
+foreach(shader ${SHADERS})
+    string(MAKE_C_IDENTIFIER "${shader}" name)
+
+    file(READ "${SHADER_DIR}/${shader}" glsl)
+    string(APPEND content "constexpr const char TS_GLSL_${name}[] = R\"TS_GLSL(${glsl})TS_GLSL\";\n\n")
+
+    if (SPIRV_DIR)
+        # spir-v is a stream of little endian 32-bit words
+        file(READ "${SPIRV_DIR}/${shader}.spv" hex HEX)
+        string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " words "${hex}")
+        # eight words per line, cmake regular expressions have no {n} quantifier
+        set(line "0x........, 0x........, 0x........, 0x........, 0x........, 0x........, 0x........, 0x........, ")
+        string(REGEX REPLACE "(${line})" "\\1\n    " words "${words}")
+        string(APPEND content "constexpr uint32_t TS_SPIRV_${name}[] = {\n    ${words}\n};\n\n")
+    endif()
+endforeach()
+
+file(WRITE "${OUTPUT}" "${content}")
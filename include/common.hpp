@@ -5,6 +5,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 
 #define CLAMP(x, lo, hi)  ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
 
@@ -16,6 +17,11 @@ extern "C" {
 /// \param hght: window height, in pixels
 void TS_Init(const char * ttl, int wdth, int hght);
 
+/// \brief initialize the state without a window or audio, rendering into offscreen images
+/// \param wdth: frame width, in pixels
+/// \param hght: frame height, in pixels
+void TS_InitHeadless(int wdth, int hght);
+
 /// \brief quit the state
 void TS_Quit();
 
@@ -70,6 +76,16 @@ float TS_NTCV(int y, int h);
 /// \returns rect as 4-array
 std::array<float, 4> TS_NTCRect(int x, int y, int w, int h, int w2, int h2);
 
-/// \brief add the next 4 indices to the index buffer, followed by a primitive restart (0xffffffff)
+/// \brief add the next 4 indices to the index buffer, followed by a primitive restart (0xffffffff). Only used when drawing triangle fans
 void TS_Add4Indices();
 
+/// \brief convert a float in [0, 1] to an 8-bit normalized integer, clamping it first
+/// \param x: value
+/// \returns normalized integer
+uint8_t TS_PackUnorm8(float x);
+
+/// \brief convert a float in [0, 1] to a 16-bit normalized integer, clamping it first
+/// \param x: value
+/// \returns normalized integer
+uint16_t TS_PackUnorm16(float x);
+
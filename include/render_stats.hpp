@@ -0,0 +1,48 @@
+//
+// Copyright 2022, Joshua Higginbotham
+//
+
+#pragma once
+
+#include <stdint.h>
+
+extern "C"
+{
+
+/// \brief statistics about the per-frame vertex and index streams
+struct TS_StreamStats
+{
+    /// \brief bytes of vertex data uploaded in the last frame
+    uint64_t vertexBytes;
+
+    /// \brief bytes of index data uploaded in the last frame
+    uint64_t indexBytes;
+
+    /// \brief bytes of instance data uploaded in the last frame
+    uint64_t instanceBytes;
+
+    /// \brief largest number of vertex bytes uploaded in a single frame
+    uint64_t vertexHighWater;
+
+    /// \brief largest number of index bytes uploaded in a single frame
+    uint64_t indexHighWater;
+
+    /// \brief largest number of instance bytes uploaded in a single frame
+    uint64_t instanceHighWater;
+
+    /// \brief current capacity of the largest vertex stream, in bytes
+    uint64_t vertexCapacity;
+
+    /// \brief current capacity of the largest index stream, in bytes
+    uint64_t indexCapacity;
+
+    /// \brief current capacity of the largest instance stream, in bytes
+    uint64_t instanceCapacity;
+
+    /// \brief number of times a stream had to be reallocated to fit a frame
+    uint64_t grows;
+
+    /// \brief quads skipped in the last frame because they were entirely outside the viewport
+    uint64_t culledQuads;
+};
+}
@@ -0,0 +1,90 @@
+//
+// Copyright 2022, Joshua Higginbotham
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+/// \brief rectangle stored in a spatial hash
+struct TS_SpatialHashItem
+{
+    /// \brief id given by the caller, -1 if the slot is free
+    int id;
+
+    /// \brief x-coordinate of the top left corner
+    float x;
+
+    /// \brief y-coordinate of the top left corner
+    float y;
+
+    /// \brief size in x-dimension
+    float w;
+
+    /// \brief size in y-dimension
+    float h;
+
+    /// \brief last query that returned the item, so items spanning several cells are returned once
+    uint32_t stamp;
+
+    /// \brief true if the item touches too many cells to be listed in each, see TS_SpatialHash::oversizedItems
+    bool oversized;
+};
+
+/// \brief uniform grid of buckets over screen or world space, used to find the rectangles overlapping an area
+/// without visiting every rectangle, e.g. the tiles of a scrolling tilemap that are inside the camera
+struct TS_SpatialHash
+{
+    /// \brief size of the square cells, in the units of the inserted rectangles
+    float cellSize;
+
+    /// \brief item slots, reused after removal
+    std::vector<TS_SpatialHashItem> items;
+
+    /// \brief free item slots
+    std::vector<uint32_t> freeItems;
+
+    /// \brief slot of each id
+    std::unordered_map<int, uint32_t> slotsById;
+
+    /// \brief slots of the items overlapping each non-empty cell, keyed by the packed cell coordinates
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+
+    /// \brief slots of the items touching too many cells to be listed in each, checked by every query
+    std::vector<uint32_t> oversizedItems;
+
+    /// \brief incremented by each query
+    uint32_t stamp;
+
+    /// \brief construct the hash
+    /// \param cellSize: size of the cells, ideally close to the size of the typical item
+    TS_SpatialHash(float cellSize);
+
+    /// \brief insert a rectangle, replacing any rectangle previously inserted with the same id.
+    /// Rectangles with a nan or infinite coordinate or size are ignored
+    /// \param id: id to report from queries
+    /// \param x: x-coordinate of the top left corner
+    /// \param y: y-coordinate of the top left corner
+    /// \param w: size in x-dimension
+    /// \param h: size in y-dimension
+    void insert(int id, float x, float y, float w, float h);
+
+    /// \brief remove a rectangle, does nothing if the id was never inserted
+    /// \param id: id of the rectangle
+    void remove(int id);
+
+    /// \brief remove all rectangles
+    void clear();
+
+    /// \brief find the rectangles overlapping an area
+    /// \param x: x-coordinate of the top left corner of the area
+    /// \param y: y-coordinate of the top left corner of the area
+    /// \param w: size of the area in x-dimension
+    /// \param h: size of the area in y-dimension
+    /// \param ids: receives up to maxIds ids, in no particular order
+    /// \param maxIds: capacity of ids
+    /// \returns number of overlapping rectangles, which may be larger than maxIds. 0 if the area is not finite
+    int query(float x, float y, float w, float h, int * ids, int maxIds);
+};
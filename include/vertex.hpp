@@ -22,6 +22,9 @@ struct TS_Vertex
   /// \brief texture id
   int tex;
 
+  /// \brief depth in [0, 1], smaller is closer
+  float depth;
+
   /// \brief ctor
   /// \param x: x position
   /// \param y: y position
@@ -32,13 +35,95 @@ struct TS_Vertex
   /// \param u: u-coordinate
   /// \param v: v-coordinate
   /// \param t: texture id
-  TS_Vertex(float x, float y, float r, float g, float b, float a, float u = 0, float v = 0, int t = -1);
+  /// \param d: depth
+  TS_Vertex(float x, float y, float r, float g, float b, float a, float u = 0, float v = 0, int t = -1, float d = 0);
+
+  /// \brief get vertices vulkan binding description
+  /// \returns description
+  static vk::VertexInputBindingDescription getBindingDescription();
+
+  /// \brief get vertices vulkan attribute description
+  /// \returns 5-array of descriptions
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions();
+};
+
+/// \brief vertex object packed for TS_VERTEX_FORMAT_COMPACT
+struct TS_CompactVertex
+{
+  /// \brief position in 2D space
+  glm::vec2 pos;
+
+  /// \brief uv coordinate
+  glm::vec2 uv;
+
+  /// \brief color, in RGBA, as unorm8
+  uint8_t col[4];
+
+  /// \brief texture id
+  int16_t tex;
+
+  /// \brief depth in [0, 1], smaller is closer, as unorm16
+  uint16_t depth;
+
+  /// \brief get vertices vulkan binding description
+  /// \returns description
+  static vk::VertexInputBindingDescription getBindingDescription();
+
+  /// \brief get vertices vulkan attribute description
+  /// \returns 5-array of descriptions
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions();
+};
+
+/// \brief vertex object packed for TS_VERTEX_FORMAT_COMPACT_HALF_UV
+struct TS_HalfUvVertex
+{
+  /// \brief position in 2D space
+  glm::vec2 pos;
+
+  /// \brief uv coordinate, as two half floats
+  uint32_t uv;
+
+  /// \brief color, in RGBA, as unorm8
+  uint8_t col[4];
+
+  /// \brief texture id
+  int16_t tex;
+
+  /// \brief depth in [0, 1], smaller is closer, as unorm16
+  uint16_t depth;
 
   /// \brief get vertices vulkan binding description
   /// \returns description
   static vk::VertexInputBindingDescription getBindingDescription();
 
   /// \brief get vertices vulkan attribute description
-  /// \returns 4-array of descriptions
-  static std::array<vk::VertexInputAttributeDescription, 4> getAttributeDescriptions();
-};
\ No newline at end of file
+  /// \returns 5-array of descriptions
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions();
+};
+
+/// \brief instance object, one per quad when drawing instanced
+struct TS_Instance
+{
+  /// \brief left, top, right and bottom edge in normalized device coordinates
+  glm::vec4 rect;
+
+  /// \brief left, top, right and bottom edge in normalized texture coordinates, as unorm16
+  uint16_t uv[4];
+
+  /// \brief color, in RGBA, as unorm8
+  uint8_t col[4];
+
+  /// \brief texture id
+  int16_t tex;
+
+  /// \brief depth in [0, 1], smaller is closer, as unorm16
+  uint16_t depth;
+
+  /// \brief get instances vulkan binding description
+  /// \returns description
+  static vk::VertexInputBindingDescription getBindingDescription();
+
+  /// \brief get instances vulkan attribute description
+  /// \returns 5-array of descriptions
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions();
+};
@@ -8,8 +8,279 @@
 
 #include <vk_mem_alloc.hpp>
 
+#include <deque>
+#include <functional>
+
 #include <shaderc/shaderc.hpp>
 
+#include <SDL2/SDL.h>
+
+#include <include/render_stats.hpp>
+
+#include <telescope.h>
+
+#include <string>
+#include <vector>
+
+/// \brief segment of the top edge of the packed area of an atlas page
+struct TS_SkylineNode {
+
+  /// \brief left end of the segment
+  int32_t x;
+
+  /// \brief height of the packed area below the segment
+  int32_t y;
+
+  /// \brief length of the segment
+  int32_t width;
+};
+
+/// \brief header written in front of the pipeline cache data on disk
+struct TS_PipelineCacheHeader {
+
+  /// \brief identifies the file as a Telescope pipeline cache
+  uint32_t magic;
+
+  /// \brief version of the file layout
+  uint32_t version;
+
+  /// \brief vendor of the device the cache was created on
+  uint32_t vendorID;
+
+  /// \brief device the cache was created on
+  uint32_t deviceID;
+
+  /// \brief version of the driver the cache was created with
+  uint32_t driverVersion;
+
+  /// \brief pipeline cache UUID reported by the driver
+  uint8_t uuid[VK_UUID_SIZE];
+
+  /// \brief number of bytes of cache data following the header
+  uint64_t dataSize;
+};
+
+/// \brief shader the quad pipelines are built from
+struct TS_ShaderSource {
+
+  /// \brief file name of the shader, relative to shaders/ or the hot reload directory
+  const char * fname;
+
+  /// \brief shader stage
+  shaderc_shader_kind kind;
+
+  /// \brief GLSL source embedded at build time
+  const char * glsl;
+
+  /// \brief SPIR-V compiled at build time, nullptr if glslc was not available
+  const uint32_t * spirv;
+
+  /// \brief size of the embedded SPIR-V, in bytes
+  size_t spirvSize;
+
+  /// \brief content hash of the source last seen by the hot reload watcher
+  uint64_t hash;
+};
+
+/// \brief quad recorded during the frame, written to the vertex or instance stream once sorted
+struct TS_QuadCommand {
+
+  /// \brief left, right, top and bottom edge in normalized device coordinates
+  std::array<float, 4> ndc;
+
+  /// \brief left, right, top and bottom edge in normalized texture coordinates
+  std::array<float, 4> ntc;
+
+  /// \brief color, in RGBA
+  glm::vec4 col;
+
+  /// \brief texture slot, -1 for an untextured quad
+  int tex;
+
+  /// \brief layer set with TS_VkSetLayer
+  int layer;
+
+  /// \brief number of quads pushed to the same layer before this one
+  uint32_t layerSeq;
+
+  /// \brief blend mode set with TS_VkSetBlendMode
+  TS_BlendMode blend;
+
+  /// \brief true if the quad is drawn instanced
+  bool instanced;
+
+  /// \brief static batch drawn by the command, -1 for a quad
+  int staticBatch;
+
+  /// \brief offset of the static batch, in normalized device coordinates
+  glm::vec2 offset;
+
+  /// \brief tilemap drawn by the command over ndc, -1 for a quad
+  int tilemap;
+};
+
+/// \brief sort key of a quad command
+struct TS_DrawKey {
+
+  /// \brief key, see TS_MakeDrawKey
+  uint64_t key;
+
+  /// \brief index of the command
+  uint32_t cmd;
+};
+
+/// \brief run of sorted quads drawn with the same path and blend mode, one static batch or one tilemap
+struct TS_DrawBatch {
+
+  /// \brief true if the quads are in the instance stream, false if they are in the vertex stream
+  bool instanced;
+
+  /// \brief blend mode of the quads
+  TS_BlendMode blend;
+
+  /// \brief index of the first quad in its stream, or of the tilemap in tilemapDraws
+  uint32_t first;
+
+  /// \brief number of quads
+  uint32_t count;
+
+  /// \brief static batch to draw instead of stream quads, -1 if none
+  int staticBatch;
+
+  /// \brief offset of the static batch, in normalized device coordinates
+  glm::vec2 offset;
+
+  /// \brief depth of the static batch or tilemap
+  float depth;
+
+  /// \brief true if the batch draws a tilemap
+  bool tilemap;
+
+  /// \brief true if the batch draws nothing and clears the depth buffer, starting the next range of painter's order
+  bool clearDepth;
+};
+
+/// \brief quad added to a static batch, kept so the batch can be built once its textures are resident
+struct TS_StaticQuad {
+
+  /// \brief texture handle, -1 for a rect
+  int txtInd;
+
+  /// \brief color, in RGBA
+  glm::vec4 col;
+
+  /// \brief sprite source region and grid cell, as passed to TS_VkCmdDrawSpriteH
+  int rx, ry, rw, rh, cw, ch, ci, cj;
+
+  /// \brief position and size of a rect, or position and scale of a sprite
+  float x, y, w, h;
+};
+
+/// \brief geometry kept in device local memory and drawn by reference
+struct TS_StaticBatch {
+
+  /// \brief quads added to the batch
+  std::vector<TS_StaticQuad> quads;
+
+  /// \brief device local buffer of instances
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+
+  /// \brief number of instances in the buffer
+  uint32_t count;
+
+  /// \brief left, right, top and bottom edge of the instances in the buffer, in normalized device coordinates
+  std::array<float, 4> bounds;
+
+  /// \brief true if quads were added since the buffer was built
+  bool dirty;
+
+  /// \brief texture residency changes counted when a build last found a texture that is not resident, 0 if none did.
+  /// The batch is not built again before the count changes
+  uint64_t waitingSince;
+};
+
+/// \brief push constants of the quad pipelines, only read by the instanced vertex shader
+struct TS_PushConstants {
+
+  /// \brief offset added to every position, in normalized device coordinates
+  glm::vec2 offset;
+
+  /// \brief depth added to every instance
+  float depth;
+};
+
+/// \brief tile layer drawn as one quad, the fragment shader looks up the tile under each pixel
+struct TS_Tilemap {
+
+  /// \brief number of tiles along the x-dimension
+  uint32_t width;
+
+  /// \brief number of tiles along the y-dimension
+  uint32_t height;
+
+  /// \brief tile index plus one for every tile, 0 for an empty tile
+  std::vector<uint16_t> tiles;
+
+  /// \brief R16 unsigned integer image holding the tiles
+  std::pair<vk::Image, vma::Allocation> img;
+
+  /// \brief view of the image
+  vk::ImageView view;
+
+  /// \brief layout of the image once the queued uploads have executed
+  vk::ImageLayout layout;
+
+  /// \brief element of the tilemap descriptor array
+  int slot;
+
+  /// \brief texture handle of the tileset
+  int tileset;
+
+  /// \brief width of a tile in the tileset, in pixels
+  uint32_t tileWidth;
+
+  /// \brief height of a tile in the tileset, in pixels
+  uint32_t tileHeight;
+
+  /// \brief rectangle of tiles changed since the last upload, empty if dirtyX0 >= dirtyX1
+  uint32_t dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+
+  /// \brief true once the tileset was reported as smaller than one tile
+  bool tilesetReported;
+};
+
+/// \brief push constants of the tilemap pipeline
+struct TS_TilemapPushConstants {
+
+  /// \brief left, top, right and bottom edge of the visible part of the map, in normalized device coordinates
+  glm::vec4 rect;
+
+  /// \brief map coordinates at the left, top, right and bottom edge, in tiles
+  glm::vec4 tiles;
+
+  /// \brief top left corner of the tileset and size of one tile, in normalized texture coordinates
+  glm::vec4 tileset;
+
+  /// \brief color, in RGBA
+  glm::vec4 col;
+
+  /// \brief depth of the quad
+  float depth;
+
+  /// \brief element of the tilemap descriptor array
+  int32_t map;
+
+  /// \brief texture slot of the tileset
+  int32_t tilesetSlot;
+
+  /// \brief tiles per row of the tileset
+  int32_t columns;
+
+  /// \brief tiles in the tileset
+  int32_t count;
+};
+
+/// \brief image bound to one of the texture slots of the descriptor set
 struct TS_Texture {
 
   /// \brief image
@@ -23,8 +294,213 @@ struct TS_Texture {
   /// \brief size along y-dimension
   uint32_t height;
 
+  /// \brief true if the image is an atlas page shared by many small images
+  bool atlas = false;
+
+  /// \brief packed area of an atlas page, from left to right
+  std::vector<TS_SkylineNode> skyline;
+
+  /// \brief number of texture regions using the image
+  uint32_t refs = 0;
+};
+
+/// \brief entry of the table mapping image paths to texture indices
+struct TS_TextureTableEntry {
+
+  /// \brief hash of the image path
+  uint64_t hash;
+
+  /// \brief texture index, -1 if the entry was never used, -2 if it was erased
+  int txtInd = -1;
+};
+
+/// \brief a loaded image, either a whole texture slot or a region of an atlas page
+struct TS_TextureRegion {
+
+  /// \brief texture slot holding the image, -1 until it is resident
+  int slot = -1;
+
+  /// \brief position along x-dimension inside the slot's image
+  int32_t x = 0;
+  /// \brief position along y-dimension inside the slot's image
+  int32_t y = 0;
+
+  /// \brief size along x-dimension
+  uint32_t width = 0;
+  /// \brief size along y-dimension
+  uint32_t height = 0;
+
   /// \brief file name
   std::string fname;
+
+  /// \brief true once the pixel data has been decoded and queued for upload
+  bool resident = false;
+
+  /// \brief true if decoding or placing the texture failed, the region is never resident and is kept until unloaded
+  bool failed = false;
+
+  /// \brief bumped whenever the region is reassigned, so stale background decodes can be recognized
+  uint32_t generation = 0;
+
+  /// \brief run once the region is resident
+  std::vector<std::pair<TS_TextureReadyCallback, void*>> callbacks;
+};
+
+/// \brief image waiting to be decoded by a background worker
+struct TS_DecodeJob {
+
+  /// \brief texture index the image is decoded for
+  int txtInd;
+
+  /// \brief generation of the texture region when the job was queued
+  uint32_t generation;
+
+  /// \brief path to image on disk
+  std::string path;
+};
+
+/// \brief result of a background decode, handed to the render thread
+struct TS_DecodedImage {
+
+  /// \brief texture index the image was decoded for
+  int txtInd;
+
+  /// \brief generation of the texture region when the job was queued
+  uint32_t generation;
+
+  /// \brief true if decoding succeeded
+  bool ok;
+
+  /// \brief error message if decoding failed
+  std::string error;
+
+  /// \brief pixels, in RGBA
+  std::vector<uint8_t> pixels;
+
+  /// \brief size along x-dimension
+  uint32_t width;
+
+  /// \brief size along y-dimension
+  uint32_t height;
+};
+
+/// \brief growable device-local buffer that is refilled every frame through a host-visible staging buffer
+struct TS_StreamBuffer {
+
+  /// \brief host-visible, persistently mapped staging buffer
+  std::pair<vk::Buffer, vma::Allocation> staging;
+
+  /// \brief device-local buffer the staging buffer is copied into
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+
+  /// \brief usage flags of the device-local buffer, in addition to transfer dst
+  vk::BufferUsageFlags usage;
+
+  /// \brief size of both buffers, in bytes
+  vk::DeviceSize capacity = 0;
+
+  /// \brief number of bytes written to the staging buffer that still need to be copied
+  vk::DeviceSize dirty = 0;
+
+  /// \brief outgrown buffers, destroyed once the frame that last used them has finished
+  std::vector<std::pair<vk::Buffer, vma::Allocation>> retired;
+};
+
+/// \brief persistently mapped host-visible buffer that texture uploads are staged in, used as a ring
+struct TS_StagingRing {
+
+  /// \brief staging buffer
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+
+  /// \brief mapped memory of the buffer
+  uint8_t * data = nullptr;
+
+  /// \brief size of the buffer, in bytes
+  vk::DeviceSize capacity = 0;
+
+  /// \brief offset of the next allocation
+  vk::DeviceSize head = 0;
+
+  /// \brief offset of the oldest allocation still in use by the gpu
+  vk::DeviceSize tail = 0;
+
+  /// \brief head of the ring at the end of each submitted frame, .first is the frame number
+  std::deque<std::pair<uint64_t, vk::DeviceSize>> marks;
+};
+
+/// \brief buffer to image copy waiting to be recorded into the next frame
+struct TS_PendingUpload {
+
+  /// \brief staging buffer the data is read from
+  vk::Buffer src;
+
+  /// \brief offset into the staging buffer
+  vk::DeviceSize offset;
+
+  /// \brief destination image
+  vk::Image img;
+
+  /// \brief layout of the image before the upload
+  vk::ImageLayout oldLayout;
+
+  /// \brief x-offset of the region inside the image
+  int32_t x;
+
+  /// \brief y-offset of the region inside the image
+  int32_t y;
+
+  /// \brief size of the region along the x-dimension
+  uint32_t width;
+
+  /// \brief size of the region along the y-dimension
+  uint32_t height;
+};
+
+/// \brief frame being copied back to host memory, see TS_VkReadbackFrame
+struct TS_Readback {
+
+  /// \brief ticket handed to the caller
+  int ticket;
+
+  /// \brief caller memory the RGBA pixels are written to, null for captures
+  uint8_t * dst;
+
+  /// \brief png the pixels are encoded to, empty unless a capture
+  std::string path;
+
+  /// \brief whether the copy has been recorded into a frame
+  bool recorded;
+
+  /// \brief number of the frame the copy was recorded into
+  uint64_t frameNumber;
+
+  /// \brief frame in flight, and so readback buffer, the copy was recorded into
+  uint32_t slot;
+
+  /// \brief width of the frame, in pixels
+  uint32_t width;
+
+  /// \brief height of the frame, in pixels
+  uint32_t height;
+};
+
+/// \brief capture waiting to be encoded to png by the encode worker
+struct TS_EncodeJob {
+
+  /// \brief png file to write
+  std::string path;
+
+  /// \brief pixels copied out of the readback buffer
+  std::vector<uint8_t> pixels;
+
+  /// \brief width of the frame, in pixels
+  uint32_t width;
+
+  /// \brief height of the frame, in pixels
+  uint32_t height;
+
+  /// \brief whether the pixels are BGRA and need swizzling
+  bool bgra;
 };
 
 #ifdef __cplusplus
@@ -73,6 +549,39 @@ void TS_VkCmdDrawSprite(
     float scale_x, float scale_y
 );
 
+/// \brief look up the texture handle of an image, loading the image in the background on first use.
+/// Drawing with the handle skips the path lookup TS_VkCmdDrawSprite does on every call
+/// \param image_path: path to image on disk
+/// \returns texture handle, valid until TS_VkUnloadTexture is called for the path
+int TS_VkRegisterTexture(const char * image_path);
+
+/// \brief draw a sprite using a texture handle, see TS_VkCmdDrawSprite
+/// \param texture: handle returned by TS_VkRegisterTexture, nothing is drawn while it is not resident
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param alpha: transparency component of the color (in RGBA)
+/// \param region_x: x-coordinate of the top left corner of the subregion
+/// \param region_y: y-coordinate of the top left corner of the subregion
+/// \param region_width: size of the subregion along the x-dimension
+/// \param region_height: size of the subregion along the x-dimension
+/// \param cell_w: width of each cell of the grid
+/// \param cell_h: height of each cell of the grid
+/// \param cell_index_i: x-index of the cell
+/// \param cell_index_j: y-index of the cell
+/// \param position_x: x-coordinate of the top left corner of the sprite
+/// \param position_y: y-coordinate of the top left corner of the sprite
+/// \param scale_x: scale along the x-dimension
+/// \param scale_y: scale along the y-dimension
+void TS_VkCmdDrawSpriteH(
+    int texture,
+    float r, float g, float b, float alpha,
+    int region_x, int region_y, int region_width, int region_height,
+    int cell_w, int cell_h, int cell_index_i, int cell_index_j,
+    float position_x, float position_y,
+    float scale_x, float scale_y
+);
+
 /// \brief clear the render window with a color
 /// \param r: red component of the color (in RGBA)
 /// \param g: green component of the color (in RGBA)
@@ -80,6 +589,60 @@ void TS_VkCmdDrawSprite(
 /// \param alpha: transparency component of the color (in RGBA)
 void TS_VkCmdClearColorImage(float r, float g, float b, float alpha);
 
+/// \brief set the number of frames the cpu may record ahead of the gpu, takes effect on the next TS_Init
+/// \param n: number of frames in flight, clamped to [1, 3]. 2 by default
+void TS_VkSetFramesInFlight(int n);
+
+/// \brief request a physical device, takes effect on the next TS_Init. TELESCOPE_DEVICE takes precedence
+/// \param name_or_uuid: uuid, or case-insensitive part of the device name. Null or empty to select automatically
+void TS_VkSetPhysicalDevice(const char * name_or_uuid);
+
+/// \brief get the name of the physical device in use
+/// \returns device name, empty before TS_Init
+const char * TS_VkGetPhysicalDeviceName();
+
+/// \brief set how frames are presented, the swapchain is recreated before the next frame
+/// \param mode: requested present mode, unsupported modes fall back, see TS_PresentMode
+void TS_VkSetPresentMode(TS_PresentMode mode);
+
+/// \brief get the present mode in use
+/// \returns present mode of the swapchain
+TS_PresentMode TS_VkGetPresentMode();
+
+/// \brief set the layout vertices are packed into when uploaded, takes effect on the next TS_Init
+/// \param format: vertex format, TS_VERTEX_FORMAT_FLOAT by default and for unknown values
+void TS_VkSetVertexFormat(TS_VertexFormat format);
+
+/// \brief draw quads as triangle fans with a primitive restart index after each, instead of
+/// triangle lists sharing a static index buffer. takes effect on the next TS_Init
+/// \param enabled: true to draw triangle fans, false by default
+void TS_VkSetTriangleFans(bool enabled);
+
+/// \brief draw every rect and sprite as a single 32 byte instance expanded by the vertex shader,
+/// instead of four vertices. Applies to the rects and sprites drawn after the call, the two kinds may be mixed within a frame
+/// \param enabled: true to draw instanced, false by default
+void TS_VkSetInstancedDrawing(bool enabled);
+
+/// \brief watch a directory for edits to the shaders, and rebuild the pipelines at the start of the
+/// next frame once an edited shader compiles. Compile errors are printed and the last working shader is kept
+/// \param shader_dir: directory containing the files in shaders/, NULL to stop watching
+void TS_VkSetShaderHotReload(const char * shader_dir);
+
+/// \brief set the blend mode of the rects and sprites drawn after this call
+/// \param mode: blend mode, TS_BLEND_MODE_ALPHA by default
+void TS_VkSetBlendMode(TS_BlendMode mode);
+
+/// \brief set the layer of the rects and sprites drawn after this call
+/// \param layer: higher layers are drawn over lower ones, 0 by default
+void TS_VkSetLayer(int layer);
+
+/// \brief get statistics about the vertex and index streams
+/// \returns TS_StreamStats object
+TS_StreamStats TS_VkGetStreamStats();
+
+/// \brief reset the high-water marks and grow counter of the stream statistics
+void TS_VkResetStreamStats();
+
 /// \brief start the drawing pass
 void TS_VkBeginDrawPass();
 
@@ -90,6 +653,42 @@ void TS_VkBeginDrawPass();
 /// \param alpha: transparency component of the color (in RGBA)
 void TS_VkEndDrawPass(float r, float g, float b, float alpha);
 
+/// \brief copy the frame being drawn back to host memory, call between TS_VkBeginDrawPass and TS_VkEndDrawPass
+/// \param pixels: receives width * height RGBA pixels, must stay valid until the readback is complete
+/// \returns ticket of the readback, -1 if the swapchain images cannot be copied from
+int TS_VkReadbackFrame(void * pixels);
+
+/// \brief check whether a readback has been written to its pixels
+/// \param ticket: ticket returned by TS_VkReadbackFrame
+/// \returns true if the pixels are ready
+bool TS_VkIsReadbackComplete(int ticket);
+
+/// \brief block until a readback has been written to its pixels
+/// \param ticket: ticket returned by TS_VkReadbackFrame
+void TS_VkWaitReadback(int ticket);
+
+/// \brief get the size of the frames being rendered
+/// \param width: receives the width, in pixels
+/// \param height: receives the height, in pixels
+void TS_VkGetFrameSize(int * width, int * height);
+
+/// \brief save the frame being drawn as a png, encoded on a worker thread
+/// \param path: png file to write
+/// \returns ticket of the readback, -1 if the swapchain images cannot be copied from
+int TS_VkCaptureFrame(const char * path);
+
+/// \brief capture every frame to path_prefix followed by a six digit frame number and .png
+/// \param path_prefix: directory and start of the file names
+/// \returns false if the swapchain images cannot be copied from
+bool TS_VkStartCapture(const char * path_prefix);
+
+/// \brief stop capturing every frame
+/// \returns number of frames skipped because the png encoder could not keep up
+uint64_t TS_VkStopCapture();
+
+/// \brief block until all captures of submitted frames have been written
+void TS_VkFlushCaptures();
+
 }
 
 /// \brief trigger debug callback
@@ -109,7 +708,7 @@ static VKAPI_ATTR vk::Bool32 VKAPI_CALL debugCallback(
 /// \param fmt: vulkan format
 /// \param flags: image aspect flags
 /// \returns created image view
-vk::ImageView TS_VkCreateImageView(vk::Image img, vk::Format fmt, vk::ImageAspectFlagBits flags);
+vk::ImageView TS_VkCreateImageView(vk::Image img, vk::Format fmt, vk::ImageAspectFlags flags);
 
 /// \brief get vulkan supported depth format
 /// \returns true if format supported, false otherwise
@@ -120,11 +719,13 @@ vk::Bool32 TS_VkGetSupportedDepthFormat();
 /// \param usage: vulkan buffer usage flags
 /// \param properties: vulkan memory properties
 /// \param allocFlags: [optional] allocation flags
+/// \param sharedWithTransfer: [optional] share the buffer between the graphics and the transfer queue family
 /// \returns pair where .first is the vulkan buffer, .second is the vma::Allcation object
 std::pair<vk::Buffer, vma::Allocation> TS_VmaCreateBuffer(
     vk::DeviceSize size, vk::Flags<vk::BufferUsageFlagBits> usage,
     vk::Flags<vk::MemoryPropertyFlagBits> properties,
-    vma::AllocationCreateFlags allocFlags = vma::AllocationCreateFlags());
+    vma::AllocationCreateFlags allocFlags = vma::AllocationCreateFlags(),
+    bool sharedWithTransfer = false);
 
 /// \brief create a vma image
 /// \param width: size along x-dimension
@@ -144,6 +745,109 @@ std::pair<vk::Image, vma::Allocation> TS_VmaCreateImage(
   vk::Flags<vk::MemoryPropertyFlagBits> properties,
   vma::AllocationCreateFlags allocFlags = vma::AllocationCreateFlags());
 
+/// \brief make sure a stream buffer can hold at least size bytes, growing it geometrically if necessary
+/// \param stream: stream buffer
+/// \param size: number of bytes needed this frame
+void TS_VmaReserveStreamBuffer(TS_StreamBuffer &stream, vk::DeviceSize size);
+
+/// \brief create a stream buffer with the default initial capacity
+/// \param usage: usage of the device-local buffer, e.g. vertex or index buffer
+/// \returns created stream buffer
+TS_StreamBuffer TS_VmaCreateStreamBuffer(vk::BufferUsageFlags usage);
+
+/// \brief mark the start of a stream's staging buffer for upload, to be written by the caller
+/// \param stream: stream buffer, grown if necessary
+/// \param size: number of bytes that will be written
+/// \returns mapped staging memory
+void * TS_VmaMapStreamBuffer(TS_StreamBuffer &stream, vk::DeviceSize size);
+
+/// \brief write data to the start of a stream's staging buffer and mark it for upload
+/// \param stream: stream buffer, grown if necessary
+/// \param data: data to copy
+/// \param size: number of bytes to copy
+void TS_VmaWriteStreamBuffer(TS_StreamBuffer &stream, const void * data, vk::DeviceSize size);
+
+/// \brief record a copy of the dirty range of a stream into its device-local buffer, followed by a barrier
+/// \param cmdbuf: command buffer to record into
+/// \param stream: stream buffer
+/// \param dstStage: pipeline stage that consumes the buffer
+/// \param dstAccess: access type of the consumer
+void TS_VkCmdFlushStreamBuffer(vk::CommandBuffer &cmdbuf, TS_StreamBuffer &stream, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+
+/// \brief destroy the buffers a stream has outgrown, only call once they are no longer in use
+/// \param stream: stream buffer
+void TS_VmaReleaseRetiredBuffers(TS_StreamBuffer &stream);
+
+/// \brief destroy a stream buffer, including retired buffers
+/// \param stream: stream buffer
+void TS_VmaDestroyStreamBuffer(TS_StreamBuffer &stream);
+
+/// \brief destroy an object once every frame that may still use it has finished on the gpu
+/// \param destroy: function destroying the object
+void TS_VkDeferDestroy(std::function<void()> destroy);
+
+/// \brief run the deferred destructions of all objects no longer in use by the gpu
+void TS_VkCollectGarbage();
+
+/// \brief create the upload staging ring
+/// \param capacity: size of the ring, in bytes
+void TS_VmaCreateStagingRing(vk::DeviceSize capacity);
+
+/// \brief destroy the upload staging ring
+void TS_VmaDestroyStagingRing();
+
+/// \brief free the parts of the staging ring used by frames that have finished
+void TS_VmaReclaimStagingRing();
+
+/// \brief allocate memory for an upload from the staging ring, growing the ring if it is full
+/// \param size: number of bytes needed
+/// \param buf: [out] staging buffer the memory belongs to
+/// \param offset: [out] offset of the memory inside buf
+/// \returns mapped pointer to write the data to
+void * TS_VmaStageUpload(vk::DeviceSize size, vk::Buffer &buf, vk::DeviceSize &offset);
+
+/// \brief create an image layout transition barrier
+/// \param img: image
+/// \param oldLayout: previous layout
+/// \param newLayout: new layout
+/// \param srcStage: [out] pipeline stage to wait on
+/// \param dstStage: [out] pipeline stage that waits
+/// \returns barrier
+vk::ImageMemoryBarrier TS_VkCreateImageBarrier(vk::Image img, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::PipelineStageFlags &srcStage, vk::PipelineStageFlags &dstStage);
+
+/// \brief queue a copy from staging memory into a region of an image, recorded at the start of the next draw
+/// \param img: destination image
+/// \param oldLayout: layout of the image before the upload
+/// \param src: staging buffer, see TS_VmaStageUpload
+/// \param offset: offset into the staging buffer
+/// \param x: x-offset of the region inside the image
+/// \param y: y-offset of the region inside the image
+/// \param wdth: width of the region
+/// \param hght: height of the region
+void TS_VkQueueImageUpload(vk::Image img, vk::ImageLayout oldLayout, vk::Buffer src, vk::DeviceSize offset, int32_t x, int32_t y, uint32_t wdth, uint32_t hght);
+
+/// \brief check whether uploads go through a dedicated transfer queue
+/// \returns true if the transfer queue family differs from the graphics one
+bool TS_VkHasTransferQueue();
+
+/// \brief get the transfer command buffer of the current frame in flight, beginning it on first use
+/// \returns transfer command buffer, submitted by TS_VkQueueSubmit
+vk::CommandBuffer TS_VkGetTransferCommandBuffer();
+
+/// \brief record uploads with one batch of transitions before and after the copies
+/// \param cmdbuf: command buffer to record into
+/// \param uploads: uploads to record
+/// \param release: release the images to the graphics queue family, queueing the matching acquire barriers
+void TS_VkCmdCopyUploads(vk::CommandBuffer cmdbuf, const std::vector<TS_PendingUpload> &uploads, bool release);
+
+/// \brief record all queued uploads. Images written for the first time go to the transfer queue if there is one
+/// \param cmdbuf: command buffer of the frame, which records the remaining uploads
+void TS_VkCmdFlushUploads(vk::CommandBuffer &cmdbuf);
+
+/// \brief acquire the images and buffers the transfer queue released this frame
+/// \param cmdbuf: command buffer of the frame
+void TS_VkCmdAcquireTransfers(vk::CommandBuffer &cmdbuf);
+
 /// \brief begin vulkan scratch buffer
 /// \returns vulkan command buffer
 vk::CommandBuffer TS_VkBeginScratchBuffer();
@@ -165,13 +869,148 @@ void TS_VkTransitionImageLayout(vk::Image img, vk::ImageLayout oldLayout, vk::Im
 /// \param hght: height of the TODO: buffer or image?
 void TS_VkCopyBufferToImage(vk::Buffer buf, vk::Image img, uint32_t wdth, uint32_t hght);
 
+/// \brief mark the descriptor sets of all frames in flight as outdated, each is rewritten before its next use
+void TS_VkInvalidateDescriptorSets();
+
 /// \brief write updated descriptor set info to device
-void TS_VkWriteDescriptorSet();
+/// \param frame: frame in flight whose descriptor set should be written, must not be in use by the gpu
+void TS_VkWriteDescriptorSet(uint32_t frame);
 
-/// \brief load texture
+/// \brief load texture, the pixel data is uploaded as part of the next frame
 /// \param img: path to image on disk
+/// \returns texture handle, -1 if the image could not be loaded
 int TS_VkLoadTexture(const char * img);
 
+/// \brief load an image file as a surface in RGBA byte order, converting it if necessary
+/// \param img: path to image on disk
+/// \returns surface, NULL if the image could not be loaded
+SDL_Surface * TS_LoadSurface(const char * img);
+
+/// \brief copy the pixels of an RGBA surface into tightly packed rows
+/// \param srf: surface created by TS_LoadSurface
+/// \param dst: destination, at least 4 * w * h bytes
+void TS_CopySurfacePixels(SDL_Surface * srf, uint8_t * dst);
+
+/// \brief decode an image file into RGBA pixels, safe to call from any thread
+/// \param img: path to image on disk
+/// \param pixels: [out] pixels, 4 bytes per pixel
+/// \param wdth: [out] width of the image
+/// \param hght: [out] height of the image
+/// \returns false if the image could not be loaded
+bool TS_DecodeImage(const char * img, std::vector<uint8_t> &pixels, uint32_t &wdth, uint32_t &hght);
+
+/// \brief hash an image path with 64-bit FNV-1a
+/// \param path: path to image on disk
+/// \returns hash
+uint64_t TS_HashPath(const char * path);
+
+/// \brief find the table entry of an image path
+/// \param img: path to image on disk
+/// \param hash: hash of the path
+/// \returns index of the entry holding the path, or of the empty entry ending its probe sequence
+size_t TS_TextureTableProbe(const char * img, uint64_t hash);
+
+/// \brief look up the texture index of an image path, without allocating
+/// \param img: path to image on disk
+/// \returns texture index, or -1 if the image is not loaded
+int TS_TextureTableFind(const char * img);
+
+/// \brief add an image path to the table, growing it if necessary
+/// \param img: path to image on disk, must not be in the table yet
+/// \param txtInd: texture index
+void TS_TextureTableInsert(const char * img, int txtInd);
+
+/// \brief remove an image path from the table
+/// \param img: path to image on disk, its texture region must still hold the path
+void TS_TextureTableErase(const char * img);
+
+/// \brief fill the queue of available texture slots on first access
+void TS_VkInitTextureSlots();
+
+/// \brief create an image in a free texture slot and bind it to the descriptor sets
+/// \param wdth: width of the image
+/// \param hght: height of the image
+/// \param atlas: true if the image is an atlas page
+/// \returns texture slot, or -1 if all texture slots are in use
+int TS_VkAllocateTextureSlot(uint32_t wdth, uint32_t hght, bool atlas);
+
+/// \brief drop a reference to a texture slot, destroying its image once no region uses it
+/// \param slot: texture slot
+void TS_VkReleaseTextureSlot(int slot);
+
+/// \brief check whether a rectangle fits on the skyline when placed at a node
+/// \param skyline: packed area of an atlas page
+/// \param i: node the left edge of the rectangle is placed at
+/// \param wdth: width of the rectangle
+/// \param hght: height of the rectangle
+/// \param size: size of the atlas page
+/// \param y: [out] position along y-dimension the rectangle would be placed at
+/// \returns true if the rectangle fits inside the page
+bool TS_SkylineFits(const std::vector<TS_SkylineNode> &skyline, size_t i, int32_t wdth, int32_t hght, int32_t size, int32_t &y);
+
+/// \brief pack a rectangle into an atlas page using the skyline bottom-left heuristic
+/// \param skyline: packed area of the atlas page, updated on success
+/// \param size: size of the atlas page
+/// \param wdth: width of the rectangle
+/// \param hght: height of the rectangle
+/// \param x: [out] position along x-dimension of the rectangle
+/// \param y: [out] position along y-dimension of the rectangle
+/// \returns false if the page has no room for the rectangle
+bool TS_SkylinePack(std::vector<TS_SkylineNode> &skyline, int32_t size, int32_t wdth, int32_t hght, int32_t &x, int32_t &y);
+
+/// \brief place a texture in an atlas page, or in a slot of its own if it is large, and queue its upload
+/// \param txtInd: texture index
+/// \param wdth: width of the image
+/// \param hght: height of the image
+/// \returns staging memory the RGBA pixels have to be written to before the next draw, nullptr if all texture slots are in use
+void * TS_VkCreateTexture(int txtInd, uint32_t wdth, uint32_t hght);
+
+/// \brief get the handle the api hands out for a texture index, made of the index and the generation of its region
+/// \param txtInd: texture index
+/// \returns texture handle, -1 if txtInd is negative
+int TS_VkTextureHandle(int txtInd);
+
+/// \brief resolve a texture handle to the index of its region
+/// \param handle: texture handle
+/// \returns texture index, -1 if the handle is invalid or its texture was unloaded since
+int TS_VkTextureHandleIndex(int handle);
+
+/// \brief assign a texture index to an image path
+/// \param img: path to image on disk
+/// \returns texture index, -1 if the maximum number of textures is loaded
+int TS_VkAllocateTextureRegion(const char * img);
+
+/// \brief load texture, decoding it on a background thread. Until it is resident, sprites using it are skipped
+/// \param img: path to image on disk
+/// \param callback: [optional] called on the render thread once the texture is resident, or with index -1 if it failed to load.
+/// A texture that failed stays registered without being decoded again, unload it to retry
+/// \param userData: [optional] passed to callback
+/// \returns texture handle
+int TS_VkLoadTextureAsync(const char * img, TS_TextureReadyCallback callback, void * userData);
+
+/// \brief check whether a texture has finished loading
+/// \param txtInd: texture handle
+/// \returns true if the texture is resident, false for handles to unloaded textures
+bool TS_VkIsTextureResident(int txtInd);
+
+/// \brief create textures for all images decoded since the last call and run their callbacks
+void TS_VkProcessDecodedTextures();
+
+/// \brief body of a background decode thread
+void TS_DecodeWorker();
+
+/// \brief start the background decode threads, if they are not already running
+void TS_VkStartDecodeWorkers();
+
+/// \brief stop and join the background decode threads, dropping all outstanding jobs
+void TS_VkStopDecodeWorkers();
+
+/// \brief create the placeholder texture bound to texture slots that hold no image
+void TS_VkCreatePlaceholderTexture();
+
+/// \brief destroy the placeholder texture
+void TS_VkDestroyPlaceholderTexture();
+
 /// \brief unload texture
 /// \param img: texture path
 void TS_VkUnloadTexture(const char * img);
@@ -183,8 +1022,46 @@ void TS_VkUnloadTexture(const char * img);
 /// \param alpha: transparency component of the color (in RGBA)
 void TS_VkCmdClearColorImage(float r, float g, float b, float a);
 
-/// \brief acquire next vulkan image
-void TS_VkAcquireNextImage();
+/// \brief convert BGRA pixels to RGBA
+/// \param dst: receives the RGBA pixels, may be src
+/// \param src: BGRA pixels
+/// \param size: size of the pixels, in bytes
+void TS_SwizzleBGRA(uint8_t * dst, const uint8_t * src, size_t size);
+
+/// \brief encode queued captures to png until stopped
+void TS_EncodeWorker();
+
+/// \brief start the encode worker, if it is not running yet
+void TS_VkStartEncodeWorker();
+
+/// \brief write the queued captures, then stop the encode worker
+void TS_VkStopEncodeWorker();
+
+/// \brief copy the pixels of a finished readback out of its readback buffer, as RGBA for the caller
+/// or raw for the encode worker
+/// \param readback: readback whose frame has completed
+void TS_VkCompleteReadback(const TS_Readback &readback);
+
+/// \brief queue a readback of the frame being drawn
+/// \param dst: caller memory, null for captures
+/// \param path: png to write, empty unless a capture
+/// \returns ticket of the readback, -1 if the swapchain images cannot be copied from
+int TS_VkRequestReadback(uint8_t * dst, const std::string &path);
+
+/// \brief complete the readbacks whose frames have finished on the gpu
+void TS_VkPollReadbacks();
+
+/// \brief record the copy of the current frame into its readback buffer, if a readback was requested
+/// \param cmdbuf: command buffer of the current frame, after the render pass
+void TS_VkCmdCopyReadbacks(vk::CommandBuffer &cmdbuf);
+
+/// \brief destroy the readback buffers
+void TS_VmaDestroyReadbackBuffers();
+
+/// \brief wait for the current frame in flight to become available, then acquire next vulkan image,
+/// recreating the swapchain first if it is out of date
+/// \returns false if no image could be acquired, e.g. while the window is minimized, and the frame is skipped
+bool TS_VkAcquireNextImage();
 
 /// \brief reset the vulkan command buffer
 void TS_VkResetCommandBuffer();
@@ -202,10 +1079,10 @@ void TS_VkDraw(float r, float g, float b, float alpha);
 /// \brief end vulkan command buffer
 void TS_VkEndCommandBuffer();
 
-/// \brief queue vulkan submit info
+/// \brief submit the frame's uploads to the transfer queue, if any, then the frame to the graphics queue
 void TS_VkQueueSubmit();
 
-/// \brief queue vulkan present
+/// \brief queue vulkan present and advance to the next frame in flight
 void TS_VkQueuePresent();
 
 /// \brief set the vulkan debug messenger
@@ -221,10 +1098,38 @@ void TS_VkCreateDebugMessenger();
 /// \brief create vulkan surface
 void TS_VkCreateSurface();
 
-/// \brief select the physical device
+/// \brief format a uuid as 8-4-4-4-12 hex digits
+/// \param uuid: VK_UUID_SIZE bytes
+/// \returns formatted uuid
+std::string TS_VkFormatUUID(const uint8_t * uuid);
+
+/// \brief get the uuid of a physical device
+/// \param device: physical device
+/// \returns formatted uuid
+std::string TS_VkGetDeviceUUID(vk::PhysicalDevice device);
+
+/// \brief check a physical device against a requested name or uuid
+/// \param device: physical device
+/// \param requested: uuid, or case-insensitive part of the device name
+/// \returns true if the device matches
+bool TS_VkMatchesRequestedDevice(vk::PhysicalDevice device, const std::string &requested);
+
+/// \brief check that a physical device supports every extension, feature and queue telescope needs
+/// \param device: physical device
+/// \param reason: receives why the device is not suitable
+/// \returns true if the device can be used
+bool TS_VkIsDeviceSuitable(vk::PhysicalDevice device, std::string &reason);
+
+/// \brief rank a physical device, discrete > integrated > virtual > cpu, then by device local memory
+/// \param device: physical device
+/// \returns score, higher is better
+uint64_t TS_VkScoreDevice(vk::PhysicalDevice device);
+
+/// \brief select the physical device, the requested one if it is usable or else the best scoring one
 void TS_VkSelectPhysicalDevice();
 
-/// \brief select vulkan queue family
+/// \brief select the graphics, present and transfer queue families. The transfer family is the graphics
+/// family unless the device has a transfer-only family without image copy granularity restrictions
 void TS_VkSelectQueueFamily();
 
 /// \brief created device
@@ -233,11 +1138,27 @@ void TS_VkCreateDevice();
 /// \brief create the vma allocator object
 void TS_VmaCreateAllocator();
 
-/// \brief create the vma buffers
+/// \brief create the vma stream buffers, one vertex and one index stream per frame in flight, and the staging ring
 void TS_VmaCreateBuffers();
 
+/// \brief pick the surface format, preferring 8-bit unorm formats
+/// \returns surface format for the swapchain
+vk::SurfaceFormatKHR TS_VkSelectSurfaceFormat();
+
+/// \brief pick the supported present mode closest to the requested one
+/// \returns present mode for the swapchain
+vk::PresentModeKHR TS_VkSelectPresentMode();
+
 /// \brief create the vulkan swapchain
-void TS_VkCreateSwapchain();
+/// \param oldSwapchain: swapchain being replaced, if any
+void TS_VkCreateSwapchain(vk::SwapchainKHR oldSwapchain = vk::SwapchainKHR());
+
+/// \brief recreate the swapchain and everything sized after it, after a resize or when it is out of date
+/// \returns false if the window is minimized, the swapchain is then left as it is
+bool TS_VkRecreateSwapchain();
+
+/// \brief create the offscreen color images rendered to instead of the swapchain when headless
+void TS_VkCreateOffscreenImages();
 
 /// \brief create the vulkan image views
 void TS_VkCreateImageViews();
@@ -248,28 +1169,209 @@ void TS_VkSetupDepthStencil();
 /// \brief create the vulkan render pass
 void TS_VkCreateRenderPass();
 
+/// \brief compile GLSL to SPIR-V with shaderc
+/// \param code: GLSL source
+/// \param kind: shader stage
+/// \param name: name of the shader, used in error messages
+/// \param optimize: optimize for performance
+/// \param spirv: receives the SPIR-V words
+/// \param error: receives the compiler output if compilation failed
+/// \returns true if the shader compiled
+bool TS_CompileShader(const std::string &code, shaderc_shader_kind kind, const char * name, bool optimize, std::vector<uint32_t> &spirv, std::string &error);
+
 /// \brief initialize the vulkan shader module
 vk::ShaderModule TS_VkCreateShaderModule(std::string code, shaderc_shader_kind kind, bool optimize = false);
 
-/// \brief create the vulkan descriptor set
+/// \brief create a shader module from SPIR-V compiled ahead of time
+/// \param code: SPIR-V words
+/// \param size: size of the code, in bytes
+vk::ShaderModule TS_VkCreateShaderModuleFromSpirv(const uint32_t * code, size_t size);
+
+/// \brief create a shader module from one of the shaders embedded at build time
+/// \param spirv: precompiled SPIR-V, nullptr if the shaders were not compiled at build time
+/// \param size: size of the SPIR-V, in bytes
+/// \param glsl: GLSL source, compiled with shaderc if there is no SPIR-V
+/// \param kind: shader stage
+vk::ShaderModule TS_VkCreateEmbeddedShaderModule(const uint32_t * spirv, size_t size, const char * glsl, shaderc_shader_kind kind);
+
+/// \brief create the vulkan descriptor sets, one per frame in flight
 void TS_VkCreateDescriptorSet();
 
-/// \brief create the vulkan triangle pipeline
+/// \brief create a pipeline drawing quads with the shared layout and render pass
+/// \param vertShaderModule: vertex shader
+/// \param fragShaderModule: fragment shader
+/// \param vertexInputInfo: layout of the vertex or instance buffer
+/// \param topology: primitive topology
+/// \param primitiveRestart: true to enable primitive restart
+/// \param blend: blend mode, blending is disabled for TS_BLEND_MODE_OPAQUE
+/// \param depthCompare: depth test of the pipeline
+/// \returns pipeline
+vk::Pipeline TS_VkCreateQuadPipeline(vk::ShaderModule vertShaderModule, vk::ShaderModule fragShaderModule, const vk::PipelineVertexInputStateCreateInfo &vertexInputInfo, vk::PrimitiveTopology topology, bool primitiveRestart, TS_BlendMode blend, vk::CompareOp depthCompare);
+
+/// \brief create a triangle or instanced pipeline variant from the current shader modules
+/// \param instanced: true for the instanced pipeline
+/// \param blend: blend mode of the variant
+/// \param depthCompare: depth test of the variant
+/// \returns pipeline
+vk::Pipeline TS_VkCreateDrawPipeline(bool instanced, TS_BlendMode blend, vk::CompareOp depthCompare);
+
+/// \brief depth test for quads drawn with a blend mode, less for opaque quads and less or equal for blended ones
+/// \param blend: blend mode
+/// \returns compare op
+vk::CompareOp TS_DepthCompareOp(TS_BlendMode blend);
+
+/// \brief look up a pipeline variant, creating it on first use
+/// \param instanced: true for the instanced pipeline
+/// \param blend: blend mode of the variant
+/// \returns pipeline
+vk::Pipeline TS_VkGetDrawPipeline(bool instanced, TS_BlendMode blend);
+
+/// \brief look up the pipeline static batches are drawn with, opaque batches pass the depth test on equal depth
+/// \param blend: blend mode of the batch
+/// \returns pipeline
+vk::Pipeline TS_VkGetStaticBatchPipeline(TS_BlendMode blend);
+
+/// \brief extend the last batch of a frame by one quad, or start a new batch if the path or blend mode changed
+/// \param instanced: true if the quad was written to the instance stream
+/// \param blend: blend mode of the quad
+/// \param quad: index of the quad in its stream
+void TS_AddToBatch(bool instanced, TS_BlendMode blend, uint32_t quad);
+
+/// \brief build the sort key of a quad command. Opaque quads sort first, front to back by layer, then by pipeline,
+/// texture and reverse submission. Blended quads follow in painter's order, by layer and then by submission
+/// \param cmd: quad command
+/// \param seq: index of the command in the frame
+/// \returns key
+uint64_t TS_MakeDrawKey(const TS_QuadCommand &cmd, uint32_t seq);
+
+/// \brief stable least significant digit radix sort of draw keys, skipping bytes shared by all keys
+/// \param keys: keys to sort
+/// \param scratch: buffer of the same size, reused between frames
+void TS_RadixSortDrawKeys(std::vector<TS_DrawKey> &keys, std::vector<TS_DrawKey> &scratch);
+
+/// \brief write a quad command to the vertex or instance stream of the frame
+/// \param cmd: quad command
+/// \param depth: depth of the quad, smaller is closer
+void TS_EmitQuad(const TS_QuadCommand &cmd, float depth);
+
+/// \brief sort the quad commands of the frame and write them out, giving each quad a depth from its position in painter's order
+void TS_VkBuildDrawBatches();
+
+/// \brief compute the rectangles of a sprite, see TS_VkCmdDrawSpriteH
+/// \param ndc: receives the left, right, top and bottom edge in normalized device coordinates
+/// \param ntc: receives the left, right, top and bottom edge in normalized texture coordinates
+/// \param slot: receives the texture slot
+/// \returns false if the texture is not resident
+bool TS_VkGetSpriteQuad(int txtInd, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy, std::array<float, 4> &ndc, std::array<float, 4> &ntc, int &slot);
+
+/// \brief build the instances of a static batch
+/// \param batch: static batch, its bounds are updated once all instances are built. Sprites whose texture failed to load
+/// or was unloaded are reported and removed from the batch
+/// \param built: receives the instances
+/// \returns false if a texture of the batch is not resident yet
+bool TS_VkBuildStaticBatch(TS_StaticBatch &batch, std::vector<TS_Instance> &built);
+
+/// \brief upload the static batches that changed since the last frame to new device local buffers
+/// \param cmdbuf: command buffer of the frame, the copies go to the transfer command buffer if there is a transfer queue
+void TS_VkCmdFlushStaticBatches(vk::CommandBuffer &cmdbuf);
+
+/// \brief destroy all static batches
+void TS_VkDestroyStaticBatches();
+
+/// \brief compute the push constants of a tilemap draw, clipped to the viewport
+/// \param cmd: command recorded by TS_VkDrawTilemap
+/// \param depth: depth of the command
+/// \param draw: receives the push constants, mirrored along the axes with a negative scale
+/// \returns false if nothing is drawn
+bool TS_VkGetTilemapDraw(const TS_QuadCommand &cmd, float depth, TS_TilemapPushConstants &draw);
+
+/// \brief queue the upload of the tiles changed since the last frame
+void TS_VkQueueTilemapUploads();
+
+/// \brief get the tilemap pipeline of a blend mode, creating it on first use
+/// \param blend: blend mode
+/// \returns pipeline
+vk::Pipeline TS_VkGetTilemapPipeline(TS_BlendMode blend);
+
+/// \brief destroy all tilemaps
+void TS_VkDestroyTilemaps();
+
+/// \brief size of a vertex in the vertex stream
+/// \returns size in bytes, depending on the vertex format
+size_t TS_VertexSize();
+
+/// \brief write the vertices of the current frame to a stream, packing them into the vertex format
+/// \param stream: vertex stream of the current frame
+void TS_VmaWriteVertexStream(TS_StreamBuffer &stream);
+
+/// \brief grow the static quad index buffer so it covers a number of quads, recording its upload
+/// \param cmdbuf: command buffer of the current frame, outside of a render pass
+/// \param quads: number of quads drawn this frame
+void TS_VkCmdReserveQuadIndices(vk::CommandBuffer &cmdbuf, uint32_t quads);
+
+/// \brief record a quad for the current frame, with the current blend mode and layer
+/// \param ndc: left, right, top and bottom edge in normalized device coordinates
+/// \param ntc: left, right, top and bottom edge in normalized texture coordinates
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param a: transparency component of the color (in RGBA)
+/// \param tex: texture slot, -1 for an untextured quad
+void TS_VkPushQuad(const std::array<float, 4> &ndc, const std::array<float, 4> &ntc, float r, float g, float b, float a, int tex);
+
+/// \brief build the header identifying the current device and driver
+/// \returns header, with a data size of 0
+TS_PipelineCacheHeader TS_VkGetPipelineCacheHeader();
+
+/// \brief create the pipeline cache shared by all pipelines, seeded from disk if a cache for the current device and driver was saved
+void TS_VkCreatePipelineCache();
+
+/// \brief write the pipeline cache to the user's pref path
+void TS_VkSavePipelineCache();
+
+/// \brief create the vulkan triangle pipeline, and the instanced pipeline sharing its layout
 void TS_VkCreateTrianglePipeline();
 
+/// \brief create the shader modules pipeline variants are created from, using shaders reloaded from disk over the embedded ones
+void TS_VkCreateShaderModules();
+
+/// \brief destroy the shader modules
+void TS_VkDestroyShaderModules();
+
+/// \brief rebuild the pipelines if the hot reload watcher compiled new shaders, the old pipelines are destroyed once no frame uses them
+void TS_VkApplyShaderReload();
+
+/// \brief hash a shader source with 64-bit FNV-1a
+/// \param code: GLSL source
+/// \param kind: shader stage, part of the hash
+/// \returns hash, used as the key of the SPIR-V cache
+uint64_t TS_HashShader(const std::string &code, shaderc_shader_kind kind);
+
+/// \brief read the shaders in the hot reload directory, and compile the ones that changed
+void TS_PollShaderSources();
+
+/// \brief body of the hot reload thread, polls the shader sources until stopped
+void TS_ShaderWatcher();
+
+/// \brief start the hot reload thread if a shader directory was set
+void TS_VkStartShaderWatcher();
+
+/// \brief stop the hot reload thread
+void TS_VkStopShaderWatcher();
+
 /// \brief create the vulkan framebuffer
 void TS_VkCreateFramebuffers();
 
-/// \brief create the vulkan command pool
+/// \brief create the vulkan command pools, for the graphics and the transfer queue family
 void TS_VkCreateCommandPool();
 
-/// \brief allocate the vulkan command buffer
+/// \brief allocate the vulkan command buffers, one per frame in flight
 void TS_VkAllocateCommandBuffers();
 
-/// \brief create the vulkan semaphores
+/// \brief create the vulkan semaphores, one pair per frame in flight
 void TS_VkCreateSemaphores();
 
-/// \brief create the vulkan fences
+/// \brief create the vulkan fences, one per frame in flight
 void TS_VkCreateFences();
 
 /// \brief initialize the vulkan state
@@ -300,6 +1402,9 @@ void TS_VkDestroyFramebuffers();
 /// \brief destroy the vulkan triangle pipeline
 void TS_VkDestroyTrianglePipeline();
 
+/// \brief save and destroy the pipeline cache
+void TS_VkDestroyPipelineCache();
+
 /// \brief destroy the vulkan descriptor set
 void TS_VkDestroyDescriptorSet();
 
@@ -315,6 +1420,9 @@ void TS_VkDestroyImageViews();
 /// \brief destroy the vulkan swap chain
 void TS_VkDestroySwapchain();
 
+/// \brief destroy the offscreen color images
+void TS_VkDestroyOffscreenImages();
+
 /// \brief destroy the vma buffer
 void TS_VmaDestroyBuffers();
 
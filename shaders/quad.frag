@@ -0,0 +1,17 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler smp;
+layout(set = 0, binding = 1) uniform texture2D txts[80];
+
+layout(location = 0) in vec4 fragCol;
+layout(location = 1) flat in int fragTex;
+layout(location = 2) in vec2 fragUv;
+
+layout(location = 0) out vec4 outCol;
+
+void main() {
+    if (fragTex == -1)
+        outCol = fragCol;
+    else
+        outCol = fragCol * texture(sampler2D(txts[fragTex], smp), fragUv);
+}
@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) in vec2 inPos;
+layout(location = 1) in vec2 inUv;
+layout(location = 2) in vec4 inCol;
+layout(location = 3) in int inTex;
+layout(location = 4) in float inDepth;
+
+layout(location = 0) out vec4 fragCol;
+layout(location = 1) out int fragTex;
+layout(location = 2) out vec2 fragUv;
+
+void main() {
+    gl_Position = vec4(inPos, inDepth, 1.0);
+    fragCol = inCol;
+    fragTex = inTex;
+    fragUv = inUv;
+}
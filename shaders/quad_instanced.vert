@@ -0,0 +1,26 @@
+#version 450
+
+layout(location = 0) in vec4 inRect;
+layout(location = 1) in vec4 inUvRect;
+layout(location = 2) in vec4 inCol;
+layout(location = 3) in int inTex;
+layout(location = 4) in float inDepth;
+
+// zero for streamed quads, static batches are drawn at an offset and depth of their own
+layout(push_constant) uniform PushConstants {
+    vec2 offset;
+    float depth;
+} pc;
+
+layout(location = 0) out vec4 fragCol;
+layout(location = 1) out int fragTex;
+layout(location = 2) out vec2 fragUv;
+
+void main() {
+    // triangle strip over the bottom right, bottom left, top right and top left corners
+    vec2 corner = vec2(1 - (gl_VertexIndex & 1), 1 - (gl_VertexIndex >> 1));
+    gl_Position = vec4(mix(inRect.xy, inRect.zw, corner) + pc.offset, inDepth + pc.depth, 1.0);
+    fragCol = inCol;
+    fragTex = inTex;
+    fragUv = mix(inUvRect.xy, inUvRect.zw, corner);
+}
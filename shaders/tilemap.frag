@@ -0,0 +1,33 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler smp;
+layout(set = 0, binding = 1) uniform texture2D txts[80];
+layout(set = 0, binding = 2) uniform utexture2D tilemaps[16];
+
+layout(push_constant) uniform PushConstants {
+    vec4 rect;
+    vec4 tiles;
+    vec4 tileset;
+    vec4 col;
+    float depth;
+    int map;
+    int tilesetTex;
+    int columns;
+    int count;
+} pc;
+
+layout(location = 0) in vec2 fragTile;
+
+layout(location = 0) out vec4 outCol;
+
+void main() {
+    // tiles are stored plus one, zero is an empty tile
+    ivec2 cell = clamp(ivec2(floor(fragTile)), ivec2(0), textureSize(usampler2D(tilemaps[pc.map], smp), 0) - 1);
+    int tile = int(texelFetch(usampler2D(tilemaps[pc.map], smp), cell, 0).r) - 1;
+    if (tile < 0 || tile >= pc.count)
+        discard;
+
+    vec2 origin = vec2(tile % pc.columns, tile / pc.columns);
+    vec2 uv = pc.tileset.xy + (origin + fract(fragTile)) * pc.tileset.zw;
+    outCol = pc.col * texture(sampler2D(txts[pc.tilesetTex], smp), uv);
+}
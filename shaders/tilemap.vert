@@ -0,0 +1,22 @@
+#version 450
+
+layout(push_constant) uniform PushConstants {
+    vec4 rect;
+    vec4 tiles;
+    vec4 tileset;
+    vec4 col;
+    float depth;
+    int map;
+    int tilesetTex;
+    int columns;
+    int count;
+} pc;
+
+layout(location = 0) out vec2 fragTile;
+
+void main() {
+    // triangle strip over the corners of the visible part of the map
+    vec2 corner = vec2(1 - (gl_VertexIndex & 1), 1 - (gl_VertexIndex >> 1));
+    gl_Position = vec4(mix(pc.rect.xy, pc.rect.zw, corner), pc.depth, 1.0);
+    fragTile = mix(pc.tiles.xy, pc.tiles.zw, corner);
+}
@@ -17,6 +17,7 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include <vk_mem_alloc.hpp>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include <shaderc/shaderc.hpp>
 #include <vk_mem_alloc.hpp>
 
@@ -37,10 +38,25 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include <set>
 #include <map>
 #include <queue>
+#include <deque>
+#include <functional>
 #include <utility>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iterator>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <cstdio>
 
 #include "telescope.h"
+#include <include/spatial_hash.hpp>
+
+// generated at build time from the files in shaders/, see cmake/EmbedSPIRV.cmake
+#include <embedded_shaders.hpp>
 
 #define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
 
@@ -48,32 +64,161 @@ const char *window_name = NULL;
 SDL_Window *win = NULL;
 int window_width = 0;
 int window_height = 0;
+bool headless = false; // rendering into offscreen images instead of a window, see TS_InitHeadless
 #define SDL_MAX_QUEUED_EVENTS 65535
 std::string events;
-const vk::DeviceSize defaultBufferSize = 1024 * 64; // 64 kb
+const vk::DeviceSize defaultBufferSize = 1024 * 64; // 64 kb, initial size of each stream buffer
 vk::Instance inst;
 VkSurfaceKHR srf;
 vk::PhysicalDevice pdev;
+std::string requestedDevice; // name or uuid, see TS_VkSetPhysicalDevice
+std::string selectedDeviceName;
 vk::Device dev;
 uint32_t graphicsQueueFamilyIndex = -1;
 uint32_t presentQueueFamilyIndex = -1;
+uint32_t transferQueueFamilyIndex = -1; // the graphics family unless the device has a usable transfer-only one
 vk::Queue gq;
 vk::Queue pq;
+vk::Queue tq;
 vk::SwapchainKHR swapchain;
 vk::SurfaceCapabilitiesKHR surfaceCapabilities;
 vk::SurfaceFormatKHR surfaceFormat;
 vk::Extent2D swapchainSize;
 std::vector<vk::Image> swapchainImages;
 uint32_t swapchainImageCount;
+bool swapchainReadable = false; // color images may be copied from, see TS_VkReadbackFrame
+TS_PresentMode requestedPresentMode = TS_PRESENT_MODE_FIFO;
+vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo; // mode actually in use, see TS_VkSelectPresentMode
+bool swapchainOutOfDate = false; // recreated before the next image is acquired
+vk::Extent2D swapchainDrawableSize; // size of the window's drawable when the swapchain was created
+bool frameSkipped = false; // the window is minimized, nothing is recorded or submitted this frame
+
+// defined with the swapchain creation functions
+bool TS_VkRecreateSwapchain();
+
+// headless only: offscreen color images, one per frame in flight, and the vulkan library SDL would load otherwise
+std::vector<std::pair<vk::Image, vma::Allocation>> offscreenImages;
+vk::DynamicLoader * vulkanLoader = nullptr;
 vk::PipelineLayout trianglePipelineLayout;
-vk::Pipeline trianglePipeline;
+
+// one pipeline variant per blend mode, created the first time the mode is drawn with
+#define TS_BLEND_MODE_COUNT 4
+vk::Pipeline trianglePipelines[TS_BLEND_MODE_COUNT];
+
+// shared by every pipeline, loaded from and saved to the user's pref path
+#define TS_PIPELINE_CACHE_MAGIC 0x43505354 // "TSPC"
+#define TS_PIPELINE_CACHE_VERSION 1
+
+struct TS_PipelineCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t uuid[VK_UUID_SIZE];
+  uint64_t dataSize;
+};
+
+vk::PipelineCache pipelineCache;
+std::string pipelineCachePath;
+
+// shaders the quad pipelines are built from, embedded at build time and optionally reloaded from disk
+#if TS_EMBEDDED_SPIRV
+#define TS_EMBEDDED_SPIRV_CODE(name) TS_SPIRV_##name, sizeof(TS_SPIRV_##name)
+#else
+#define TS_EMBEDDED_SPIRV_CODE(name) nullptr, 0
+#endif
+
+#define TS_SHADER_QUAD_VERT 0
+#define TS_SHADER_QUAD_INSTANCED_VERT 1
+#define TS_SHADER_QUAD_FRAG 2
+#define TS_SHADER_TILEMAP_VERT 3
+#define TS_SHADER_TILEMAP_FRAG 4
+#define TS_SHADER_COUNT 5
+#define TS_SHADER_WATCH_INTERVAL_MS 250
+
+struct TS_ShaderSource {
+  const char * fname;
+  shaderc_shader_kind kind;
+  const char * glsl;
+  const uint32_t * spirv;
+  size_t spirvSize;
+  uint64_t hash;
+};
+
+TS_ShaderSource shaderSources[TS_SHADER_COUNT] = {
+  {"quad.vert", shaderc_glsl_vertex_shader, TS_GLSL_quad_vert, TS_EMBEDDED_SPIRV_CODE(quad_vert), 0},
+  {"quad_instanced.vert", shaderc_glsl_vertex_shader, TS_GLSL_quad_instanced_vert, TS_EMBEDDED_SPIRV_CODE(quad_instanced_vert), 0},
+  {"quad.frag", shaderc_glsl_fragment_shader, TS_GLSL_quad_frag, TS_EMBEDDED_SPIRV_CODE(quad_frag), 0},
+  {"tilemap.vert", shaderc_glsl_vertex_shader, TS_GLSL_tilemap_vert, TS_EMBEDDED_SPIRV_CODE(tilemap_vert), 0},
+  {"tilemap.frag", shaderc_glsl_fragment_shader, TS_GLSL_tilemap_frag, TS_EMBEDDED_SPIRV_CODE(tilemap_frag), 0},
+};
+
+std::string shaderReloadDir;
+std::thread shaderWatcher;
+std::mutex shaderWatchMutex;
+std::condition_variable shaderWatchCv;
+bool shaderWatchQuit = false;
+bool shaderReloadPending = false;
+std::vector<uint32_t> reloadedSpirv[TS_SHADER_COUNT]; // empty while the embedded shader is used
+std::map<uint64_t, std::vector<uint32_t>> spirvCache; // keyed by TS_HashShader, only touched by the watcher
+vk::ShaderModule shaderModules[TS_SHADER_COUNT]; // kept to create pipeline variants on demand
 std::vector<vk::ImageView> swapchainImageViews;
 vk::Format depthFormat;
 std::pair<vk::Image, vma::Allocation> depthImage;
-std::pair<vk::Buffer, vma::Allocation> vertexStaging;
-std::pair<vk::Buffer, vma::Allocation> indexStaging;
-std::pair<vk::Buffer, vma::Allocation> vertexBuffer;
-std::pair<vk::Buffer, vma::Allocation> indexBuffer;
+
+struct TS_StreamBuffer {
+  std::pair<vk::Buffer, vma::Allocation> staging;
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+  vk::BufferUsageFlags usage;
+  vk::DeviceSize capacity = 0;
+  vk::DeviceSize dirty = 0;
+
+  std::vector<std::pair<vk::Buffer, vma::Allocation>> retired;
+};
+
+// one stream per frame in flight, since each frame has its own fence
+std::vector<TS_StreamBuffer> vertexStreams;
+std::vector<TS_StreamBuffer> indexStreams;
+TS_StreamStats streamStats;
+
+const vk::DeviceSize defaultStagingSize = 1024 * 1024 * 8; // 8 mb, initial size of the upload staging ring
+const vk::DeviceSize stagingAlignment = 16;
+
+struct TS_StagingRing {
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+  uint8_t * data = nullptr;
+  vk::DeviceSize capacity = 0;
+  vk::DeviceSize head = 0;
+  vk::DeviceSize tail = 0;
+
+  // head of the ring at the end of each submitted frame, .first is the frame number
+  std::deque<std::pair<uint64_t, vk::DeviceSize>> marks;
+};
+
+struct TS_PendingUpload {
+  vk::Buffer src;
+  vk::DeviceSize offset;
+  vk::Image img;
+  vk::ImageLayout oldLayout;
+  int32_t x;
+  int32_t y;
+  uint32_t width;
+  uint32_t height;
+};
+
+TS_StagingRing stagingRing;
+std::vector<TS_PendingUpload> pendingUploads;
+
+uint64_t frameCount = 0; // number of frames submitted so far
+uint64_t completedFrames = 0; // all frames with a lower number have finished on the gpu
+std::vector<std::pair<uint64_t, std::function<void()>>> deferredDestroys;
+
+struct TS_SkylineNode {
+  int32_t x;
+  int32_t y;
+  int32_t width;
+};
 
 struct TS_Texture {
   std::pair<vk::Image, vma::Allocation> img;
@@ -82,32 +227,110 @@ struct TS_Texture {
   uint32_t width;
   uint32_t height;
 
+  bool atlas = false;
+  std::vector<TS_SkylineNode> skyline;
+  uint32_t refs = 0;
+};
+
+#define TS_TEXTURE_TABLE_EMPTY -1
+#define TS_TEXTURE_TABLE_TOMBSTONE -2
+
+struct TS_TextureTableEntry {
+  uint64_t hash;
+  int txtInd = TS_TEXTURE_TABLE_EMPTY;
+};
+
+struct TS_TextureRegion {
+  int slot = -1;
+  int32_t x = 0;
+  int32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+
   std::string fname;
+
+  bool resident = false;
+  bool failed = false; // never becomes resident, the region is kept until the texture is unloaded
+  uint32_t generation = 0;
+  std::vector<std::pair<TS_TextureReadyCallback, void*>> callbacks;
 };
 
 vk::Sampler smp;
 vk::DescriptorPool dscPool;
-vk::DescriptorSet dscSet;
+std::vector<vk::DescriptorSet> dscSets; // one per frame in flight, so a pending frame's set is never rewritten
+std::vector<bool> dscSetsDirty;
 vk::DescriptorSetLayout dscSetLayout;
 
 #define NUM_SUPPORTED_TEXTURES 80
 std::queue<int> availableInds;
-std::map<std::string, int> txtInds;
 std::array<TS_Texture, NUM_SUPPORTED_TEXTURES> txts;
 std::array<vk::DescriptorImageInfo, NUM_SUPPORTED_TEXTURES> dscImgInfos;
 
+// tile index images of the tilemaps have a descriptor array of their own, see TS_VkCreateTilemap
+#define TS_MAX_TILEMAPS 16
+std::array<vk::DescriptorImageInfo, TS_MAX_TILEMAPS> tilemapImgInfos; // null view while the slot is free
+
+// images no larger than this are packed into shared atlas pages instead of taking a slot of their own
+#define TS_ATLAS_PAGE_SIZE 2048
+#define TS_ATLAS_MAX_IMAGE_SIZE 256
+#define TS_ATLAS_PADDING 1
+
+// one region per loaded image, the index into txtRegions is what the api calls the texture index
+std::vector<TS_TextureRegion> txtRegions;
+std::queue<int> availableRegions;
+
+// handles given out by the api hold the generation of their region above its index,
+// so a handle kept after its texture was unloaded does not resolve to the next image in the region
+#define TS_TEXTURE_HANDLE_INDEX_BITS 16
+#define TS_TEXTURE_HANDLE_GENERATION_MASK 0x7fff
+uint64_t residencyChanges = 1; // bumped whenever a region becomes resident, fails or is unloaded
+
+// open addressing table from image path to texture index, so lookups by path never allocate
+std::vector<TS_TextureTableEntry> txtTable;
+size_t txtTableCount = 0;
+size_t txtTableTombstones = 0;
+
+// bound to texture slots that hold no image
+std::pair<vk::Image, vma::Allocation> placeholderImg;
+vk::ImageView placeholderView;
+
+struct TS_DecodeJob {
+  int txtInd;
+  uint32_t generation;
+  std::string path;
+};
+
+struct TS_DecodedImage {
+  int txtInd;
+  uint32_t generation;
+  bool ok;
+  std::string error;
+  std::vector<uint8_t> pixels;
+  uint32_t width;
+  uint32_t height;
+};
+
+std::vector<std::thread> decodeWorkers;
+std::mutex decodeMutex;
+std::condition_variable decodeCv;
+std::queue<TS_DecodeJob> decodeJobs;
+std::vector<TS_DecodedImage> decodedImages;
+bool decodeQuit = false;
+
 struct TS_Vertex {
   glm::vec2 pos;
   glm::vec2 uv;
   glm::vec4 col;
   int tex;
+  float depth;
 
-  TS_Vertex(float x, float y, float r, float g, float b, float a, float u = 0, float v = 0, int t = -1)
+  TS_Vertex(float x, float y, float r, float g, float b, float a, float u = 0, float v = 0, int t = -1, float d = 0)
   {
     this->pos = glm::vec2(x, y);
     this->uv = glm::vec2(u, v);
     this->col = glm::vec4(r, g, b, a);
     this->tex = t;
+    this->depth = d;
   }
 
   static vk::VertexInputBindingDescription getBindingDescription()
@@ -120,9 +343,9 @@ struct TS_Vertex {
     return bindingDescription;
   }
 
-  static std::array<vk::VertexInputAttributeDescription, 4> getAttributeDescriptions()
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions()
   {
-    std::array<vk::VertexInputAttributeDescription, 4> attributeDescriptions;
+    std::array<vk::VertexInputAttributeDescription, 5> attributeDescriptions;
 
     attributeDescriptions[0].binding = 0;
     attributeDescriptions[0].location = 0;
@@ -144,6 +367,167 @@ struct TS_Vertex {
     attributeDescriptions[3].format = vk::Format::eR32Sint;
     attributeDescriptions[3].offset = offsetof(TS_Vertex, tex);
 
+    attributeDescriptions[4].binding = 0;
+    attributeDescriptions[4].location = 4;
+    attributeDescriptions[4].format = vk::Format::eR32Sfloat;
+    attributeDescriptions[4].offset = offsetof(TS_Vertex, depth);
+
+    return attributeDescriptions;
+  }
+};
+
+// compact layouts TS_Vertex is packed into while it is written to the vertex stream,
+// the vertex shader is shared since the attribute formats convert to the same inputs
+struct TS_CompactVertex {
+  glm::vec2 pos;
+  glm::vec2 uv;
+  uint8_t col[4]; // RGBA, unorm8
+  int16_t tex;
+  uint16_t depth; // unorm16
+
+  static vk::VertexInputBindingDescription getBindingDescription()
+  {
+    vk::VertexInputBindingDescription bindingDescription;
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(TS_CompactVertex);
+    bindingDescription.inputRate = vk::VertexInputRate::eVertex;
+
+    return bindingDescription;
+  }
+
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions()
+  {
+    std::array<vk::VertexInputAttributeDescription, 5> attributeDescriptions;
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = vk::Format::eR32G32Sfloat;
+    attributeDescriptions[0].offset = offsetof(TS_CompactVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = vk::Format::eR32G32Sfloat;
+    attributeDescriptions[1].offset = offsetof(TS_CompactVertex, uv);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = vk::Format::eR8G8B8A8Unorm;
+    attributeDescriptions[2].offset = offsetof(TS_CompactVertex, col);
+
+    attributeDescriptions[3].binding = 0;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = vk::Format::eR16Sint;
+    attributeDescriptions[3].offset = offsetof(TS_CompactVertex, tex);
+
+    attributeDescriptions[4].binding = 0;
+    attributeDescriptions[4].location = 4;
+    attributeDescriptions[4].format = vk::Format::eR16Unorm;
+    attributeDescriptions[4].offset = offsetof(TS_CompactVertex, depth);
+
+    return attributeDescriptions;
+  }
+};
+
+struct TS_HalfUvVertex {
+  glm::vec2 pos;
+  uint32_t uv; // two half floats
+  uint8_t col[4]; // RGBA, unorm8
+  int16_t tex;
+  uint16_t depth; // unorm16
+
+  static vk::VertexInputBindingDescription getBindingDescription()
+  {
+    vk::VertexInputBindingDescription bindingDescription;
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(TS_HalfUvVertex);
+    bindingDescription.inputRate = vk::VertexInputRate::eVertex;
+
+    return bindingDescription;
+  }
+
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions()
+  {
+    std::array<vk::VertexInputAttributeDescription, 5> attributeDescriptions;
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = vk::Format::eR32G32Sfloat;
+    attributeDescriptions[0].offset = offsetof(TS_HalfUvVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = vk::Format::eR16G16Sfloat;
+    attributeDescriptions[1].offset = offsetof(TS_HalfUvVertex, uv);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = vk::Format::eR8G8B8A8Unorm;
+    attributeDescriptions[2].offset = offsetof(TS_HalfUvVertex, col);
+
+    attributeDescriptions[3].binding = 0;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = vk::Format::eR16Sint;
+    attributeDescriptions[3].offset = offsetof(TS_HalfUvVertex, tex);
+
+    attributeDescriptions[4].binding = 0;
+    attributeDescriptions[4].location = 4;
+    attributeDescriptions[4].format = vk::Format::eR16Unorm;
+    attributeDescriptions[4].offset = offsetof(TS_HalfUvVertex, depth);
+
+    return attributeDescriptions;
+  }
+};
+
+TS_VertexFormat vertexFormat = TS_VERTEX_FORMAT_FLOAT;
+TS_VertexFormat requestedVertexFormat = TS_VERTEX_FORMAT_FLOAT; // see TS_VkSetVertexFormat, applied by TS_VkInit
+
+// one record per quad, the vertex shader expands it into the four corners
+struct TS_Instance {
+  glm::vec4 rect; // left, top, right, bottom in normalized device coordinates
+  uint16_t uv[4]; // left, top, right, bottom in normalized texture coordinates, unorm16
+  uint8_t col[4]; // RGBA, unorm8
+  int16_t tex;
+  uint16_t depth; // unorm16
+
+  static vk::VertexInputBindingDescription getBindingDescription()
+  {
+    vk::VertexInputBindingDescription bindingDescription;
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(TS_Instance);
+    bindingDescription.inputRate = vk::VertexInputRate::eInstance;
+
+    return bindingDescription;
+  }
+
+  static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions()
+  {
+    std::array<vk::VertexInputAttributeDescription, 5> attributeDescriptions;
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = vk::Format::eR32G32B32A32Sfloat;
+    attributeDescriptions[0].offset = offsetof(TS_Instance, rect);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = vk::Format::eR16G16B16A16Unorm;
+    attributeDescriptions[1].offset = offsetof(TS_Instance, uv);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = vk::Format::eR8G8B8A8Unorm;
+    attributeDescriptions[2].offset = offsetof(TS_Instance, col);
+
+    attributeDescriptions[3].binding = 0;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = vk::Format::eR16Sint;
+    attributeDescriptions[3].offset = offsetof(TS_Instance, tex);
+
+    attributeDescriptions[4].binding = 0;
+    attributeDescriptions[4].location = 4;
+    attributeDescriptions[4].format = vk::Format::eR16Unorm;
+    attributeDescriptions[4].offset = offsetof(TS_Instance, depth);
+
     return attributeDescriptions;
   }
 };
@@ -151,15 +535,194 @@ struct TS_Vertex {
 std::vector<TS_Vertex> vertices;
 std::vector<uint32_t> indices;
 uint32_t current_index = 0;
+std::vector<TS_Instance> instances;
+bool instancedDrawing = false;
+
+// quads are drawn as triangle lists through a static index buffer unless fans are requested,
+// the buffer holds 0, 1, 2, 2, 3, 0 offset by 4 for every quad and only grows
+const uint32_t defaultQuadIndexCapacity = 4096;
+bool triangleFans = false;
+bool requestedTriangleFans = false; // see TS_VkSetTriangleFans, applied by TS_VkInit
+std::pair<vk::Buffer, vma::Allocation> quadIndexBuffer;
+uint32_t quadIndexCapacity = 0; // number of quads covered by the buffer
+std::vector<TS_StreamBuffer> instanceStreams;
+vk::Pipeline instancedPipelines[TS_BLEND_MODE_COUNT];
+
+// quads are recorded as commands and only written to the streams once sorted, see TS_VkBuildDrawBatches
+struct TS_QuadCommand {
+  std::array<float, 4> ndc;
+  std::array<float, 4> ntc;
+  glm::vec4 col;
+  int tex;
+  int layer;
+  uint32_t layerSeq; // quads pushed to the same layer before this one
+  TS_BlendMode blend;
+  bool instanced;
+  int staticBatch; // -1 unless the command draws a static batch
+  glm::vec2 offset; // static batches only, in normalized device coordinates
+  int tilemap; // -1 unless the command draws a tilemap, which is drawn over ndc
+};
+
+struct TS_DrawKey {
+  uint64_t key;
+  uint32_t cmd;
+};
+
+// runs of sorted quads drawn with the same path and blend mode, one static batch or one tilemap
+struct TS_DrawBatch {
+  bool instanced;
+  TS_BlendMode blend;
+  uint32_t first; // index into tilemapDraws for tilemaps
+  uint32_t count;
+  int staticBatch;
+  glm::vec2 offset;
+  float depth;
+  bool tilemap;
+  bool clearDepth; // no draw, starts a new depth range, see TS_VkBuildDrawBatches
+};
+
+// quads added to a static batch, kept so the instances can be built once their textures are resident
+struct TS_StaticQuad {
+  int txtInd; // -1 for rects
+  glm::vec4 col;
+  int rx, ry, rw, rh, cw, ch, ci, cj; // sprite source, as passed to TS_VkCmdDrawSpriteH
+  float x, y, w, h; // rect position and size, or sprite position and scale
+};
+
+// geometry uploaded to device local memory once and drawn by reference, see TS_VkCreateStaticBatch
+struct TS_StaticBatch {
+  std::vector<TS_StaticQuad> quads;
+  std::pair<vk::Buffer, vma::Allocation> buffer;
+  uint32_t count; // instances in the buffer
+  std::array<float, 4> bounds; // of the instances in the buffer, in normalized device coordinates
+  bool dirty; // quads were added since the buffer was built
+  uint64_t waitingSince; // residencyChanges when a build last found a texture not resident, 0 if none did
+};
+
+// push constants of the quad pipelines, only read by the instanced vertex shader
+struct TS_PushConstants {
+  glm::vec2 offset;
+  float depth;
+};
+
+// tile layer drawn as one quad, the fragment shader looks up the tile under each pixel
+struct TS_Tilemap {
+  uint32_t width, height; // in tiles
+  std::vector<uint16_t> tiles; // tile index plus one, 0 for an empty tile
+  std::pair<vk::Image, vma::Allocation> img;
+  vk::ImageView view;
+  vk::ImageLayout layout; // of img once the queued uploads have executed
+  int slot; // in tilemapImgInfos
+  int tileset; // texture handle
+  uint32_t tileWidth, tileHeight; // in pixels
+  uint32_t dirtyX0, dirtyY0, dirtyX1, dirtyY1; // tiles changed since the last upload, empty if dirtyX0 >= dirtyX1
+  bool tilesetReported; // the tileset was found to be smaller than one tile, reported once
+};
+
+// push constants of the tilemap pipeline, they share the range of the quad pipelines
+struct TS_TilemapPushConstants {
+  glm::vec4 rect; // left, top, right, bottom of the visible part of the map in normalized device coordinates
+  glm::vec4 tiles; // map coordinates at the left, top, right and bottom edge, in tiles
+  glm::vec4 tileset; // top left corner of the tileset and size of one tile, in normalized texture coordinates
+  glm::vec4 col;
+  float depth;
+  int32_t map; // slot of the tile index image
+  int32_t tilesetSlot;
+  int32_t columns; // tiles per row of the tileset
+  int32_t count; // tiles in the tileset
+};
+
+// every push constant update names all stages of the range
+const vk::ShaderStageFlags pushConstantStages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+
+#define TS_MIN_LAYER -32768
+#define TS_MAX_LAYER 32767
+
+TS_BlendMode blendMode = TS_BLEND_MODE_ALPHA;
+int drawLayer = 0;
+std::vector<TS_QuadCommand> quadCommands;
+std::vector<TS_DrawKey> drawKeys;
+std::vector<TS_DrawKey> drawKeysScratch;
+std::map<int, uint32_t> layerCounts; // quads per layer, then the painter's order rank of each layer's first quad
+std::vector<TS_DrawBatch> drawBatches;
+std::map<int, TS_StaticBatch> staticBatchesById;
+std::map<int, TS_Tilemap> tilemapsById;
+std::vector<TS_TilemapPushConstants> tilemapDraws; // tilemaps drawn this frame
+vk::Pipeline tilemapPipelines[TS_BLEND_MODE_COUNT];
+vk::Pipeline opaqueStaticBatchPipeline; // passes on equal depth, all quads of a static batch share one
+
+// quads that get a depth of their own before the depth buffer has to be cleared. the step between
+// neighbours is one unorm16 unit, so every depth format and the unorm16 vertex depths keep them apart
+#define TS_DEPTH_RANKS 65534
+uint64_t culledQuads = 0; // quads rejected this frame for lying entirely outside the viewport
+
+// defined with the pipeline creation functions
+vk::Pipeline TS_VkGetDrawPipeline(bool instanced, TS_BlendMode blend);
+vk::Pipeline TS_VkGetStaticBatchPipeline(TS_BlendMode blend);
+vk::Pipeline TS_VkGetTilemapPipeline(TS_BlendMode blend);
 vk::ImageView depthImageView;
 vk::RenderPass rp;
 std::vector<vk::Framebuffer> swapchainFramebuffers;
 vk::CommandPool cp;
 std::vector<vk::CommandBuffer> cmdbufs;
-vk::Semaphore imageAvailableSemaphore;
-vk::Semaphore renderingFinishedSemaphore;
-std::vector<vk::Fence> fences;
-uint32_t frameIndex;
+#define TS_MAX_FRAMES_IN_FLIGHT 3
+uint32_t framesInFlight = 2;
+uint32_t requestedFramesInFlight = 2; // see TS_VkSetFramesInFlight, copied into framesInFlight by TS_VkInit
+uint32_t currentFrame = 0; // frame in flight currently being recorded
+std::vector<vk::Semaphore> imageAvailableSemaphores;
+std::vector<vk::Semaphore> renderingFinishedSemaphores;
+
+// uploads recorded for the dedicated transfer queue, one command buffer and semaphore per frame in flight.
+// ownership of what they write is released there and acquired by the frame's command buffer
+vk::CommandPool transferCp;
+std::vector<vk::CommandBuffer> transferCmdbufs;
+std::vector<vk::Semaphore> transferFinishedSemaphores;
+bool transferRecording = false; // transferCmdbufs[currentFrame] has been begun this frame
+std::vector<vk::ImageMemoryBarrier> transferAcquireImageBarriers;
+std::vector<vk::BufferMemoryBarrier> transferAcquireBufferBarriers;
+std::vector<vk::Fence> fences; // one per frame in flight
+std::vector<vk::Fence> imagesInFlight; // fence of the frame last rendering to each swapchain image
+uint32_t frameIndex; // index of the acquired swapchain image
+
+// frames copied back to host memory, see TS_VkReadbackFrame
+struct TS_Readback {
+  int ticket;
+  uint8_t * dst; // null for captures
+  std::string path; // png written by the encode worker, empty unless a capture
+  bool recorded; // the copy is in the command buffer of frameNumber
+  uint64_t frameNumber;
+  uint32_t slot; // frame in flight, and readback buffer, the copy was recorded into
+  uint32_t width, height;
+};
+
+std::vector<TS_Readback> pendingReadbacks;
+std::vector<std::pair<vk::Buffer, vma::Allocation>> readbackBuffers; // one per frame in flight, created on first use
+std::vector<vk::DeviceSize> readbackCapacities;
+std::vector<bool> readbackCoherent; // otherwise the mapping is invalidated before reading
+int nextReadbackTicket = 1;
+
+// captures are encoded to png off the render thread, see TS_VkCaptureFrame
+#define TS_MAX_PENDING_CAPTURES 8
+
+struct TS_EncodeJob {
+  std::string path;
+  std::vector<uint8_t> pixels;
+  uint32_t width;
+  uint32_t height;
+  bool bgra; // swizzled by the worker
+};
+
+std::thread encodeWorker;
+std::mutex encodeMutex;
+std::condition_variable encodeCv;
+std::condition_variable encodeDoneCv;
+std::queue<TS_EncodeJob> encodeJobs;
+std::vector<std::vector<uint8_t>> encodeBuffers; // pixel storage handed back by the worker
+size_t encodeBusy = 0; // jobs taken by the worker but not written yet
+bool encodeQuit = false;
+std::string capturePrefix; // frames are captured continuously while not empty
+uint32_t captureCount = 0;
+uint64_t droppedCaptures = 0;
 vma::Allocator al;
 vk::DebugUtilsMessengerEXT dbm;
 
@@ -299,7 +862,7 @@ static VKAPI_ATTR vk::Bool32 VKAPI_CALL debugCallback(
   return VK_FALSE;
 }
 
-vk::ImageView TS_VkCreateImageView(vk::Image img, vk::Format fmt, vk::ImageAspectFlagBits flags)
+vk::ImageView TS_VkCreateImageView(vk::Image img, vk::Format fmt, vk::ImageAspectFlags flags)
 {
   vk::ImageViewCreateInfo viewInfo;
   viewInfo.viewType = vk::ImageViewType::e2D;
@@ -316,12 +879,13 @@ vk::ImageView TS_VkCreateImageView(vk::Image img, vk::Format fmt, vk::ImageAspec
 
 vk::Bool32 TS_VkGetSupportedDepthFormat()
 {
+  // stencil is not used, formats without it come first
   std::vector<vk::Format> depthFormats = {
-    vk::Format::eD32SfloatS8Uint,
     vk::Format::eD32Sfloat,
+    vk::Format::eD32SfloatS8Uint,
     vk::Format::eD24UnormS8Uint,
-    vk::Format::eD16UnormS8Uint,
-    vk::Format::eD16Unorm
+    vk::Format::eD16Unorm,
+    vk::Format::eD16UnormS8Uint
   };
 
   for (auto& format : depthFormats)
@@ -339,13 +903,23 @@ vk::Bool32 TS_VkGetSupportedDepthFormat()
 
 std::pair<vk::Buffer, vma::Allocation> TS_VmaCreateBuffer(vk::DeviceSize size, vk::Flags<vk::BufferUsageFlagBits> usage,
                       vk::Flags<vk::MemoryPropertyFlagBits> properties,
-                      vma::AllocationCreateFlags allocFlags = vma::AllocationCreateFlags())
+                      vma::AllocationCreateFlags allocFlags = vma::AllocationCreateFlags(),
+                      bool sharedWithTransfer = false)
 {
   vk::BufferCreateInfo bufferInfo;
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = vk::SharingMode::eExclusive;
 
+  // read by both the graphics and the transfer queue without ownership transfers
+  uint32_t queueFamilyIndices[] = {graphicsQueueFamilyIndex, transferQueueFamilyIndex};
+  if (sharedWithTransfer && graphicsQueueFamilyIndex != transferQueueFamilyIndex)
+  {
+    bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+  }
+
   vma::AllocationCreateInfo allocInfo {
     allocFlags,
     vma::MemoryUsage::eUnknown,
@@ -382,90 +956,224 @@ std::pair<vk::Image, vma::Allocation> TS_VmaCreateImage(uint32_t width, uint32_t
   return al.createImage(imageInfo, allocInfo);
 }
 
-const char * TS_SDLGetError()
+void TS_VmaReserveStreamBuffer(TS_StreamBuffer &stream, vk::DeviceSize size)
 {
-  return SDL_GetError();
+  if (size <= stream.capacity) return;
+
+  // grow geometrically so a steadily increasing scene only reallocates a handful of times
+  vk::DeviceSize capacity = std::max(stream.capacity, defaultBufferSize);
+  while (capacity < size)
+  {
+    capacity *= 2;
+  }
+
+  // commands already recorded this frame may still reference the old buffers,
+  // so they are kept alive until the fence of this frame has signaled
+  if (stream.capacity > 0)
+  {
+    stream.retired.push_back(stream.staging);
+    stream.retired.push_back(stream.buffer);
+    ++streamStats.grows;
+  }
+
+  stream.staging = TS_VmaCreateBuffer(capacity, vk::BufferUsageFlagBits::eTransferSrc,
+                                      vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible,
+                                      vma::AllocationCreateFlagBits::eMapped);
+  stream.buffer = TS_VmaCreateBuffer(capacity, vk::BufferUsageFlagBits::eTransferDst | stream.usage,
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal);
+  stream.capacity = capacity;
 }
 
-// normalized device coordinates along the x and y axes
-float TS_NDCX(float x)
+TS_StreamBuffer TS_VmaCreateStreamBuffer(vk::BufferUsageFlags usage)
 {
- return (2.0f / window_width) * x - 1.0f;
+  TS_StreamBuffer stream;
+  stream.usage = usage;
+  TS_VmaReserveStreamBuffer(stream, defaultBufferSize);
+  return stream;
 }
 
-float TS_NDCY(float y)
+void TS_VmaReleaseRetiredBuffers(TS_StreamBuffer &stream)
 {
-  return (2.0f / window_height) * y - 1.0f;
+  for (auto &buf : stream.retired)
+  {
+    al.destroyBuffer(buf.first, buf.second);
+  }
+  stream.retired.clear();
 }
 
-std::array<float, 4> TS_NDCRect(float x, float y, float w, float h)
+void TS_VmaDestroyStreamBuffer(TS_StreamBuffer &stream)
 {
-  return std::array<float, 4>({TS_NDCX(x), TS_NDCX(x + w), TS_NDCY(y), TS_NDCY(y + h)});
+  TS_VmaReleaseRetiredBuffers(stream);
+  al.destroyBuffer(stream.staging.first, stream.staging.second);
+  al.destroyBuffer(stream.buffer.first, stream.buffer.second);
+  stream.capacity = 0;
 }
 
-// normalized texture coordinates along the u and v axes
-float TS_NTCU(int x, int w)
+void * TS_VmaMapStreamBuffer(TS_StreamBuffer &stream, vk::DeviceSize size)
 {
- return (1.0f / w) * x;
+  TS_VmaReserveStreamBuffer(stream, size);
+  stream.dirty = size;
+  return al.getAllocationInfo(stream.staging.second).pMappedData;
 }
 
-float TS_NTCV(int y, int h)
+void TS_VmaWriteStreamBuffer(TS_StreamBuffer &stream, const void * data, vk::DeviceSize size)
 {
-  return (1.0f / h) * y;
+  void * dst = TS_VmaMapStreamBuffer(stream, size);
+  if (size > 0)
+  {
+    memcpy(dst, data, size);
+  }
 }
 
-std::array<float, 4> TS_NTCRect(int x, int y, int w, int h, int w2, int h2)
+void TS_VkCmdFlushStreamBuffer(vk::CommandBuffer &cmdbuf, TS_StreamBuffer &stream, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
 {
-  return std::array<float, 4>({TS_NTCU(x, w2), TS_NTCU(x + w, w2), TS_NTCV(y, h2), TS_NTCV(y + h, h2)});
+  // nothing was written this frame, nothing to copy
+  if (stream.dirty == 0) return;
+
+  vk::BufferCopy bfcpy;
+  bfcpy.srcOffset = 0;
+  bfcpy.dstOffset = 0;
+  bfcpy.size = stream.dirty;
+  cmdbuf.copyBuffer(stream.staging.first, stream.buffer.first, 1, &bfcpy);
+
+  // make the copied range visible to whatever consumes the buffer
+  vk::BufferMemoryBarrier barrier;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = stream.buffer.first;
+  barrier.offset = 0;
+  barrier.size = stream.dirty;
+  cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStage, vk::DependencyFlags(), 0, nullptr, 1, &barrier, 0, nullptr);
+
+  stream.dirty = 0;
 }
 
-void TS_Add4Indices()
+TS_StreamStats TS_VkGetStreamStats()
 {
-  indices.push_back(current_index);
-  indices.push_back(current_index + 1);
-  indices.push_back(current_index + 2);
-  indices.push_back(current_index + 3);
-  indices.push_back(0xffffffff); // primitive restart
-  current_index += 4;
+  TS_StreamStats stats = streamStats;
+  stats.vertexCapacity = 0;
+  stats.indexCapacity = 0;
+  for (const TS_StreamBuffer &stream : vertexStreams)
+  {
+    stats.vertexCapacity = std::max<uint64_t>(stats.vertexCapacity, stream.capacity);
+  }
+  for (const TS_StreamBuffer &stream : indexStreams)
+  {
+    stats.indexCapacity = std::max<uint64_t>(stats.indexCapacity, stream.capacity);
+  }
+  stats.instanceCapacity = 0;
+  for (const TS_StreamBuffer &stream : instanceStreams)
+  {
+    stats.instanceCapacity = std::max<uint64_t>(stats.instanceCapacity, stream.capacity);
+  }
+  return stats;
 }
 
-vk::CommandBuffer TS_VkBeginScratchBuffer()
+void TS_VkResetStreamStats()
 {
-  vk::CommandBufferAllocateInfo allocInfo;
-  allocInfo.level = vk::CommandBufferLevel::ePrimary;
-  allocInfo.commandPool = cp;
-  allocInfo.commandBufferCount = 1;
-
-  vk::CommandBuffer tmp = dev.allocateCommandBuffers(allocInfo)[0];
+  streamStats = TS_StreamStats();
+}
 
-  vk::CommandBufferBeginInfo beginInfo;
-  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+void TS_VkDeferDestroy(std::function<void()> destroy)
+{
+  // the frame currently being recorded (or the next one, between frames) may still use the object
+  deferredDestroys.push_back(std::make_pair(frameCount, std::move(destroy)));
+}
 
-  tmp.begin(beginInfo);
+void TS_VkCollectGarbage()
+{
+  auto done = std::stable_partition(deferredDestroys.begin(), deferredDestroys.end(),
+    [](const std::pair<uint64_t, std::function<void()>> &d) { return d.first >= completedFrames; });
 
-  return tmp;
+  for (auto it = done; it != deferredDestroys.end(); ++it)
+  {
+    it->second();
+  }
+  deferredDestroys.erase(done, deferredDestroys.end());
 }
 
-void TS_VkSubmitScratchBuffer(vk::CommandBuffer &tmp)
+void TS_VmaCreateStagingRing(vk::DeviceSize capacity)
 {
-  tmp.end();
-
-  vk::SubmitInfo submitInfo;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &tmp;
+  // uploads are copied from the ring by the transfer queue, index data by the graphics queue
+  stagingRing.buffer = TS_VmaCreateBuffer(capacity, vk::BufferUsageFlagBits::eTransferSrc,
+                                          vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible,
+                                          vma::AllocationCreateFlagBits::eMapped, true);
+  stagingRing.data = static_cast<uint8_t*>(al.getAllocationInfo(stagingRing.buffer.second).pMappedData);
+  stagingRing.capacity = capacity;
+  stagingRing.head = 0;
+  stagingRing.tail = 0;
+  stagingRing.marks.clear();
+}
 
-  gq.submit(1, &submitInfo, vk::Fence());
-  gq.waitIdle();
+void TS_VmaDestroyStagingRing()
+{
+  al.destroyBuffer(stagingRing.buffer.first, stagingRing.buffer.second);
+  stagingRing = TS_StagingRing();
+}
 
-  dev.freeCommandBuffers(cp, 1, &tmp);
+void TS_VmaReclaimStagingRing()
+{
+  while (!stagingRing.marks.empty() && stagingRing.marks.front().first < completedFrames)
+  {
+    stagingRing.tail = stagingRing.marks.front().second;
+    stagingRing.marks.pop_front();
+  }
 }
 
-void TS_VkTransitionImageLayout(vk::Image img, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
+void * TS_VmaStageUpload(vk::DeviceSize size, vk::Buffer &buf, vk::DeviceSize &offset)
 {
-  vk::CommandBuffer tmp = TS_VkBeginScratchBuffer();
+  size = (size + stagingAlignment - 1) & ~(stagingAlignment - 1);
 
-  vk::ImageMemoryBarrier barrier;
-  barrier.oldLayout = oldLayout;
+  TS_StagingRing &ring = stagingRing;
+
+  // ring is empty, start over at the front
+  if (ring.head == ring.tail && ring.marks.empty())
+  {
+    ring.head = 0;
+    ring.tail = 0;
+  }
+
+  bool found = false;
+  if (ring.head >= ring.tail)
+  {
+    // free space is [head, capacity) and [0, tail)
+    if (ring.capacity - ring.head >= size)
+    {
+      found = true;
+    }
+    else if (ring.tail > size)
+    {
+      ring.head = 0;
+      found = true;
+    }
+  }
+  else if (ring.tail - ring.head > size)
+  {
+    // free space is [head, tail)
+    found = true;
+  }
+
+  if (!found)
+  {
+    // out of space, the old buffer stays alive until the copies reading from it have executed
+    std::pair<vk::Buffer, vma::Allocation> old = ring.buffer;
+    TS_VkDeferDestroy([old]() { al.destroyBuffer(old.first, old.second); });
+    TS_VmaCreateStagingRing(std::max(ring.capacity * 2, size * 2));
+  }
+
+  buf = ring.buffer.first;
+  offset = ring.head;
+  ring.head += size;
+
+  return ring.data + offset;
+}
+
+vk::ImageMemoryBarrier TS_VkCreateImageBarrier(vk::Image img, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::PipelineStageFlags &srcStage, vk::PipelineStageFlags &dstStage)
+{
+  vk::ImageMemoryBarrier barrier;
+  barrier.oldLayout = oldLayout;
   barrier.newLayout = newLayout;
   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -476,15 +1184,19 @@ void TS_VkTransitionImageLayout(vk::Image img, vk::ImageLayout oldLayout, vk::Im
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
-  vk::PipelineStageFlags srcStage;
-  vk::PipelineStageFlags dstStage;
-
   if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eTransferDstOptimal)
   {
     barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
     srcStage = vk::PipelineStageFlagBits::eTopOfPipe;
     dstStage = vk::PipelineStageFlagBits::eTransfer;
   }
+  else if (oldLayout == vk::ImageLayout::eShaderReadOnlyOptimal && newLayout == vk::ImageLayout::eTransferDstOptimal)
+  {
+    // earlier frames may still be sampling the image
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    srcStage = vk::PipelineStageFlagBits::eFragmentShader;
+    dstStage = vk::PipelineStageFlagBits::eTransfer;
+  }
   else if (oldLayout == vk::ImageLayout::eTransferDstOptimal && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
   {
     barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
@@ -498,6 +1210,247 @@ void TS_VkTransitionImageLayout(vk::Image img, vk::ImageLayout oldLayout, vk::Im
     throw std::runtime_error("Attempting an unsupported image layout transition");
   }
 
+  return barrier;
+}
+
+void TS_VkQueueImageUpload(vk::Image img, vk::ImageLayout oldLayout, vk::Buffer src, vk::DeviceSize offset, int32_t x, int32_t y, uint32_t wdth, uint32_t hght)
+{
+  TS_PendingUpload upload;
+  upload.src = src;
+  upload.offset = offset;
+  upload.img = img;
+  upload.oldLayout = oldLayout;
+  upload.x = x;
+  upload.y = y;
+  upload.width = wdth;
+  upload.height = hght;
+  pendingUploads.push_back(upload);
+}
+
+bool TS_VkHasTransferQueue()
+{
+  return transferQueueFamilyIndex != graphicsQueueFamilyIndex;
+}
+
+vk::CommandBuffer TS_VkGetTransferCommandBuffer()
+{
+  if (!transferRecording)
+  {
+    // the frame that last submitted it waited for it before its fence signaled
+    transferCmdbufs[currentFrame].reset();
+    transferCmdbufs[currentFrame].begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    transferRecording = true;
+  }
+  return transferCmdbufs[currentFrame];
+}
+
+void TS_VkCmdCopyUploads(vk::CommandBuffer cmdbuf, const std::vector<TS_PendingUpload> &uploads, bool release)
+{
+  // each image is transitioned once, no matter how many regions of it are written
+  std::vector<vk::Image> imgs;
+  std::vector<vk::ImageMemoryBarrier> preBarriers;
+  std::vector<vk::ImageMemoryBarrier> postBarriers;
+  vk::PipelineStageFlags preSrcStage, preDstStage, postSrcStage, postDstStage;
+
+  for (const TS_PendingUpload &upload : uploads)
+  {
+    if (std::find(imgs.begin(), imgs.end(), upload.img) != imgs.end()) continue;
+    imgs.push_back(upload.img);
+
+    vk::PipelineStageFlags srcStage, dstStage;
+    preBarriers.push_back(TS_VkCreateImageBarrier(upload.img, upload.oldLayout, vk::ImageLayout::eTransferDstOptimal, srcStage, dstStage));
+    preSrcStage |= srcStage;
+    preDstStage |= dstStage;
+
+    postBarriers.push_back(TS_VkCreateImageBarrier(upload.img, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, srcStage, dstStage));
+    postSrcStage |= srcStage;
+    postDstStage |= dstStage;
+  }
+
+  if (release)
+  {
+    // the layout transition happens as part of the ownership transfer, the graphics queue makes the writes visible
+    for (vk::ImageMemoryBarrier &barrier : postBarriers)
+    {
+      barrier.srcQueueFamilyIndex = transferQueueFamilyIndex;
+      barrier.dstQueueFamilyIndex = graphicsQueueFamilyIndex;
+      vk::ImageMemoryBarrier acquire = barrier;
+      barrier.dstAccessMask = vk::AccessFlags();
+      acquire.srcAccessMask = vk::AccessFlags();
+      transferAcquireImageBarriers.push_back(acquire);
+    }
+    postDstStage = vk::PipelineStageFlagBits::eBottomOfPipe;
+  }
+
+  cmdbuf.pipelineBarrier(preSrcStage, preDstStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, static_cast<uint32_t>(preBarriers.size()), preBarriers.data());
+
+  for (const TS_PendingUpload &upload : uploads)
+  {
+    vk::BufferImageCopy region;
+    region.bufferOffset = upload.offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+
+    region.imageOffset = vk::Offset3D(upload.x, upload.y, 0);
+    region.imageExtent = vk::Extent3D(upload.width, upload.height, 1);
+
+    cmdbuf.copyBufferToImage(upload.src, upload.img, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+  }
+
+  cmdbuf.pipelineBarrier(postSrcStage, postDstStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, static_cast<uint32_t>(postBarriers.size()), postBarriers.data());
+}
+
+void TS_VkCmdFlushUploads(vk::CommandBuffer &cmdbuf)
+{
+  if (pendingUploads.empty()) return;
+
+  // images written for the first time go through the transfer queue. images the graphics queue has sampled
+  // stay on it, handing them over and back within a frame would cost more than the copy
+  if (TS_VkHasTransferQueue())
+  {
+    std::vector<vk::Image> fresh;
+    std::vector<vk::Image> seen;
+    for (const TS_PendingUpload &upload : pendingUploads)
+    {
+      if (std::find(seen.begin(), seen.end(), upload.img) != seen.end()) continue;
+      seen.push_back(upload.img);
+      if (upload.oldLayout == vk::ImageLayout::eUndefined) fresh.push_back(upload.img);
+    }
+
+    std::vector<TS_PendingUpload> transferUploads;
+    std::vector<TS_PendingUpload> graphicsUploads;
+    for (const TS_PendingUpload &upload : pendingUploads)
+    {
+      bool isFresh = std::find(fresh.begin(), fresh.end(), upload.img) != fresh.end();
+      (isFresh ? transferUploads : graphicsUploads).push_back(upload);
+    }
+
+    if (!transferUploads.empty()) TS_VkCmdCopyUploads(TS_VkGetTransferCommandBuffer(), transferUploads, true);
+    if (!graphicsUploads.empty()) TS_VkCmdCopyUploads(cmdbuf, graphicsUploads, false);
+  }
+  else
+  {
+    TS_VkCmdCopyUploads(cmdbuf, pendingUploads, false);
+  }
+
+  pendingUploads.clear();
+}
+
+void TS_VkCmdAcquireTransfers(vk::CommandBuffer &cmdbuf)
+{
+  if (transferAcquireImageBarriers.empty() && transferAcquireBufferBarriers.empty()) return;
+
+  // the frame's submission waits for the transfer at these stages, see TS_VkQueueSubmit
+  vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eFragmentShader;
+  cmdbuf.pipelineBarrier(stages, stages, vk::DependencyFlags(),
+                         0, nullptr,
+                         static_cast<uint32_t>(transferAcquireBufferBarriers.size()), transferAcquireBufferBarriers.data(),
+                         static_cast<uint32_t>(transferAcquireImageBarriers.size()), transferAcquireImageBarriers.data());
+  transferAcquireImageBarriers.clear();
+  transferAcquireBufferBarriers.clear();
+}
+
+const char * TS_SDLGetError()
+{
+  return SDL_GetError();
+}
+
+// normalized device coordinates along the x and y axes
+float TS_NDCX(float x)
+{
+ return (2.0f / window_width) * x - 1.0f;
+}
+
+float TS_NDCY(float y)
+{
+  return (2.0f / window_height) * y - 1.0f;
+}
+
+std::array<float, 4> TS_NDCRect(float x, float y, float w, float h)
+{
+  return std::array<float, 4>({TS_NDCX(x), TS_NDCX(x + w), TS_NDCY(y), TS_NDCY(y + h)});
+}
+
+// normalized texture coordinates along the u and v axes
+float TS_NTCU(int x, int w)
+{
+ return (1.0f / w) * x;
+}
+
+float TS_NTCV(int y, int h)
+{
+  return (1.0f / h) * y;
+}
+
+std::array<float, 4> TS_NTCRect(int x, int y, int w, int h, int w2, int h2)
+{
+  return std::array<float, 4>({TS_NTCU(x, w2), TS_NTCU(x + w, w2), TS_NTCV(y, h2), TS_NTCV(y + h, h2)});
+}
+
+uint8_t TS_PackUnorm8(float x)
+{
+  return uint8_t(CLAMP(x, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+uint16_t TS_PackUnorm16(float x)
+{
+  return uint16_t(CLAMP(x, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+void TS_Add4Indices()
+{
+  indices.push_back(current_index);
+  indices.push_back(current_index + 1);
+  indices.push_back(current_index + 2);
+  indices.push_back(current_index + 3);
+  indices.push_back(0xffffffff); // primitive restart
+  current_index += 4;
+}
+
+vk::CommandBuffer TS_VkBeginScratchBuffer()
+{
+  vk::CommandBufferAllocateInfo allocInfo;
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandPool = cp;
+  allocInfo.commandBufferCount = 1;
+
+  vk::CommandBuffer tmp = dev.allocateCommandBuffers(allocInfo)[0];
+
+  vk::CommandBufferBeginInfo beginInfo;
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+  tmp.begin(beginInfo);
+
+  return tmp;
+}
+
+void TS_VkSubmitScratchBuffer(vk::CommandBuffer &tmp)
+{
+  tmp.end();
+
+  vk::SubmitInfo submitInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &tmp;
+
+  gq.submit(1, &submitInfo, vk::Fence());
+  gq.waitIdle();
+
+  dev.freeCommandBuffers(cp, 1, &tmp);
+}
+
+void TS_VkTransitionImageLayout(vk::Image img, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
+{
+  vk::CommandBuffer tmp = TS_VkBeginScratchBuffer();
+
+  vk::PipelineStageFlags srcStage;
+  vk::PipelineStageFlags dstStage;
+  vk::ImageMemoryBarrier barrier = TS_VkCreateImageBarrier(img, oldLayout, newLayout, srcStage, dstStage);
+
   tmp.pipelineBarrier(srcStage, dstStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
 
   TS_VkSubmitScratchBuffer(tmp);
@@ -525,7 +1478,12 @@ void TS_VkCopyBufferToImage(vk::Buffer buf, vk::Image img, uint32_t wdth, uint32
   TS_VkSubmitScratchBuffer(tmp);
 }
 
-void TS_VkWriteDescriptorSet()
+void TS_VkInvalidateDescriptorSets()
+{
+  dscSetsDirty.assign(dscSets.size(), true);
+}
+
+void TS_VkWriteDescriptorSet(uint32_t frame)
 {
   vk::WriteDescriptorSet setWrites[2];
 
@@ -536,7 +1494,7 @@ void TS_VkWriteDescriptorSet()
   setWrites[0].dstArrayElement = 0;
 	setWrites[0].descriptorType = vk::DescriptorType::eSampler;
 	setWrites[0].descriptorCount = 1;
-	setWrites[0].dstSet = dscSet;
+	setWrites[0].dstSet = dscSets[frame];
 	setWrites[0].pBufferInfo = 0;
 	setWrites[0].pImageInfo = &samplerInfo;
 
@@ -545,268 +1503,2163 @@ void TS_VkWriteDescriptorSet()
 	setWrites[1].descriptorType = vk::DescriptorType::eSampledImage;
 	setWrites[1].descriptorCount = NUM_SUPPORTED_TEXTURES;
 	setWrites[1].pBufferInfo = 0;
-	setWrites[1].dstSet = dscSet;
+	setWrites[1].dstSet = dscSets[frame];
 	setWrites[1].pImageInfo = dscImgInfos.data();
 
   dev.updateDescriptorSets(2, setWrites, 0, nullptr);
+
+  // tile index images, one write per tilemap since free slots hold no image
+  std::vector<vk::WriteDescriptorSet> tilemapWrites;
+  for (uint32_t i = 0; i < TS_MAX_TILEMAPS; ++i)
+  {
+    if (!tilemapImgInfos[i].imageView) continue;
+
+    vk::WriteDescriptorSet write;
+    write.dstBinding = 2;
+    write.dstArrayElement = i;
+    write.descriptorType = vk::DescriptorType::eSampledImage;
+    write.descriptorCount = 1;
+    write.dstSet = dscSets[frame];
+    write.pImageInfo = &tilemapImgInfos[i];
+    tilemapWrites.push_back(write);
+  }
+  if (!tilemapWrites.empty())
+  {
+    dev.updateDescriptorSets(static_cast<uint32_t>(tilemapWrites.size()), tilemapWrites.data(), 0, nullptr);
+  }
+  dscSetsDirty[frame] = false;
 }
 
-int TS_VkLoadTexture(const char * img)
+SDL_Surface * TS_LoadSurface(const char * img)
 {
-  // initialize on first access
-  if (txtInds.empty() && availableInds.empty())
+  SDL_Surface *srf = IMG_Load(img);
+  if (srf == NULL) return NULL;
+
+  // already in the byte order of vk::Format::eR8G8B8A8Unorm, nothing to convert
+  if (srf->format->format == SDL_PIXELFORMAT_RGBA32) return srf;
+
+  // sdl's blitters handle the swizzle, alpha, palettes and color keys in one pass
+  SDL_Surface *converted = SDL_ConvertSurfaceFormat(srf, SDL_PIXELFORMAT_RGBA32, 0);
+  SDL_FreeSurface(srf);
+  return converted;
+}
+
+void TS_CopySurfacePixels(SDL_Surface * srf, uint8_t * dst)
+{
+  size_t rowSize = size_t(srf->w) * 4;
+
+  SDL_LockSurface(srf);
+  if (size_t(srf->pitch) == rowSize)
   {
-    for (int i = 0; i < NUM_SUPPORTED_TEXTURES; ++i)
+    memcpy(dst, srf->pixels, rowSize * srf->h);
+  }
+  else
+  {
+    // rows are padded, copy them one by one
+    for (int y = 0; y < srf->h; ++y)
     {
-      availableInds.push(i);
+      memcpy(dst + y * rowSize, ((uint8_t*)srf->pixels) + y * srf->pitch, rowSize);
     }
   }
+  SDL_UnlockSurface(srf);
+}
 
-  // max textures allocated
-  if (availableInds.empty())
+bool TS_DecodeImage(const char * img, std::vector<uint8_t> &pixels, uint32_t &wdth, uint32_t &hght)
+{
+  SDL_Surface *srf = TS_LoadSurface(img);
+  if (srf == NULL) return false;
+
+  wdth = srf->w;
+  hght = srf->h;
+
+  pixels.resize(size_t(wdth) * hght * 4);
+  TS_CopySurfacePixels(srf, pixels.data());
+  SDL_FreeSurface(srf);
+
+  return true;
+}
+
+uint64_t TS_HashPath(const char * path)
+{
+  // 64-bit fnv-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (const char * c = path; *c != '\0'; ++c)
   {
-    return -1;
+    hash ^= uint8_t(*c);
+    hash *= 1099511628211ull;
   }
+  return hash;
+}
 
-  // key not present means texture not loaded yet
-  if (!txtInds.count(std::string(img)))
+size_t TS_TextureTableProbe(const char * img, uint64_t hash)
+{
+  // linear probing, stops at the entry holding the path or the first empty one
+  size_t mask = txtTable.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask)
   {
-    int txtInd = availableInds.front();
-
-    SDL_Surface *srf = IMG_Load(img);
-    int wdth = srf->w;
-    int hght = srf->h;
+    const TS_TextureTableEntry &entry = txtTable[i];
+    if (entry.txtInd == TS_TEXTURE_TABLE_EMPTY) return i;
+    if (entry.txtInd != TS_TEXTURE_TABLE_TOMBSTONE && entry.hash == hash && txtRegions[entry.txtInd].fname == img) return i;
+  }
+}
 
-    std::vector<uint8_t> pixels;
-    SDL_PixelFormat * fmt = srf->format;
+int TS_TextureTableFind(const char * img)
+{
+  if (txtTable.empty()) return -1;
+  return txtTable[TS_TextureTableProbe(img, TS_HashPath(img))].txtInd;
+}
 
-    SDL_LockSurface(srf);
-    for (int i = 0; i < wdth * hght; ++i)
+void TS_TextureTableInsert(const char * img, int txtInd)
+{
+  // keep at most 3/4 of the table in use, tombstones included, so probes stay short and always end
+  if ((txtTableCount + txtTableTombstones + 1) * 4 > txtTable.size() * 3)
+  {
+    // the size stays a power of two so the hash can be masked
+    size_t size = 64;
+    while (size < (txtTableCount + 1) * 2) size *= 2;
+
+    std::vector<TS_TextureTableEntry> old;
+    old.swap(txtTable);
+    txtTable.resize(size, TS_TextureTableEntry());
+    txtTableTombstones = 0;
+    for (const TS_TextureTableEntry &entry : old)
     {
-      // https://wiki.libsdl.org/SDL_PixelFormat
-      if (fmt->BitsPerPixel != 8)
-      {
-        uint32_t temp, pixel;
-        uint8_t r, g, b, a;
-        pixel = *((uint32_t*)(((char*)srf->pixels) + i * fmt->BytesPerPixel));
-
-        temp = pixel & fmt->Rmask;
-        temp = temp >> fmt->Rshift;
-        temp = temp << fmt->Rloss;
-        r = (uint8_t)temp;
-
-        temp = pixel & fmt->Gmask;
-        temp = temp >> fmt->Gshift;
-        temp = temp << fmt->Gloss;
-        g = (uint8_t)temp;
-
-        temp = pixel & fmt->Bmask;
-        temp = temp >> fmt->Bshift;
-        temp = temp << fmt->Bloss;
-        b = (uint8_t)temp;
-
-        temp = pixel & fmt->Amask;
-        temp = temp >> fmt->Ashift;
-        temp = temp << fmt->Aloss;
-        a = (uint8_t)temp;
-
-        pixels.push_back(r);
-        pixels.push_back(g);
-        pixels.push_back(b);
-        pixels.push_back(255); // TODO fix this
-      }
-      else
-      {
-        SDL_Color col = fmt->palette->colors[*(uint8_t *) (((char*)srf->pixels) + i)];
-        pixels.push_back(col.r);
-        pixels.push_back(col.g);
-        pixels.push_back(col.b);
-        pixels.push_back(col.a);
-      }
+      if (entry.txtInd < 0) continue;
+      txtTable[TS_TextureTableProbe(txtRegions[entry.txtInd].fname.c_str(), entry.hash)] = entry;
     }
-    SDL_UnlockSurface(srf);
-    SDL_FreeSurface(srf);
+  }
 
-    std::pair<vk::Buffer, vma::Allocation> pixelStaging = TS_VmaCreateBuffer(pixels.size() * sizeof(uint8_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, vma::AllocationCreateFlagBits::eMapped);
-    memcpy(al.getAllocationInfo(pixelStaging.second).pMappedData, (void*)pixels.data(), pixels.size() * sizeof(uint8_t));
-    std::pair<vk::Image, vma::Allocation> pixelImg = TS_VmaCreateImage(wdth, hght, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    TS_VkTransitionImageLayout(pixelImg.first, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-    TS_VkCopyBufferToImage(pixelStaging.first, pixelImg.first, wdth, hght);
-    TS_VkTransitionImageLayout(pixelImg.first, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
-    vk::ImageView v = TS_VkCreateImageView(pixelImg.first, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
-    al.destroyBuffer(pixelStaging.first, pixelStaging.second);
+  uint64_t hash = TS_HashPath(img);
+  TS_TextureTableEntry &entry = txtTable[TS_TextureTableProbe(img, hash)];
+  if (entry.txtInd == TS_TEXTURE_TABLE_EMPTY) ++txtTableCount;
+  entry.hash = hash;
+  entry.txtInd = txtInd;
+}
 
-    txts[txtInd] = TS_Texture();
-    txts[txtInd].img = pixelImg;
-    txts[txtInd].fname = std::string(img);
-    txts[txtInd].view = v;
-    txts[txtInd].width = wdth;
-    txts[txtInd].height = hght;
+void TS_TextureTableErase(const char * img)
+{
+  if (txtTable.empty()) return;
 
-    dscImgInfos[txtInd] = vk::DescriptorImageInfo();
-    dscImgInfos[txtInd].sampler = nullptr;
-    dscImgInfos[txtInd].imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    dscImgInfos[txtInd].imageView = v;
+  TS_TextureTableEntry &entry = txtTable[TS_TextureTableProbe(img, TS_HashPath(img))];
+  if (entry.txtInd == TS_TEXTURE_TABLE_EMPTY) return;
 
-    txtInds[std::string(img)] = txtInd;
-    availableInds.pop();
+  // later entries of the same probe sequence must still be found
+  entry.txtInd = TS_TEXTURE_TABLE_TOMBSTONE;
+  --txtTableCount;
+  ++txtTableTombstones;
+}
 
-    TS_VkWriteDescriptorSet();
+void TS_VkInitTextureSlots()
+{
+  // initialize on first access
+  if (txtTableCount == 0 && availableInds.empty())
+  {
+    for (int i = 0; i < NUM_SUPPORTED_TEXTURES; ++i)
+    {
+      availableInds.push(i);
+    }
   }
-
-  return txtInds[std::string(img)];
 }
 
-void TS_VkUnloadTexture(const char * img)
+int TS_VkAllocateTextureSlot(uint32_t wdth, uint32_t hght, bool atlas)
 {
-  // retrieve index from map
-  int ind = txtInds[std::string(img)];
+  // max textures allocated
+  if (availableInds.empty())
+  {
+    return -1;
+  }
 
-  // remove from map
-  txtInds.erase(std::string(img));
+  int slot = availableInds.front();
+  availableInds.pop();
 
-  // reset index in txts
-  txts[ind] = TS_Texture();
+  std::pair<vk::Image, vma::Allocation> pixelImg = TS_VmaCreateImage(wdth, hght, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal);
+  vk::ImageView v = TS_VkCreateImageView(pixelImg.first, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
+
+  txts[slot] = TS_Texture();
+  txts[slot].img = pixelImg;
+  txts[slot].view = v;
+  txts[slot].width = wdth;
+  txts[slot].height = hght;
+  txts[slot].atlas = atlas;
+  if (atlas)
+  {
+    txts[slot].skyline.push_back({0, 0, int32_t(wdth)});
+  }
 
-  // reset index in dscImgInfos
-  dscImgInfos[ind] = vk::DescriptorImageInfo();
+  dscImgInfos[slot] = vk::DescriptorImageInfo();
+  dscImgInfos[slot].sampler = nullptr;
+  dscImgInfos[slot].imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  dscImgInfos[slot].imageView = v;
 
-  // return index to queue
-  availableInds.push(ind);
+  TS_VkInvalidateDescriptorSets();
 
-  // update descriptor set
-  TS_VkWriteDescriptorSet();
+  return slot;
 }
 
-void TS_VkCmdDrawRect(float r, float g, float b, float a, float x, float y, float w, float h)
+void TS_VkReleaseTextureSlot(int slot)
 {
-  // convert from screen space to normalized device coordinates
-  std::array<float, 4> ndc = TS_NDCRect(x, y, w, h);
+  // other regions of the atlas page are still in use
+  if (--txts[slot].refs > 0) return;
+
+  // drop uploads that have not been recorded yet
+  vk::Image released = txts[slot].img.first;
+  pendingUploads.erase(std::remove_if(pendingUploads.begin(), pendingUploads.end(),
+    [released](const TS_PendingUpload &upload) { return upload.img == released; }), pendingUploads.end());
+
+  // frames in flight may still sample the texture
+  std::pair<vk::Image, vma::Allocation> releasedImg = txts[slot].img;
+  vk::ImageView releasedView = txts[slot].view;
+  TS_VkDeferDestroy([releasedImg, releasedView]() {
+    dev.destroyImageView(releasedView);
+    al.destroyImage(releasedImg.first, releasedImg.second);
+  });
 
-  // update vertices
-  vertices.push_back(TS_Vertex(ndc[1], ndc[3], r, g, b, a));
-  vertices.push_back(TS_Vertex(ndc[0], ndc[3], r, g, b, a));
-  vertices.push_back(TS_Vertex(ndc[0], ndc[2], r, g, b, a));
-  vertices.push_back(TS_Vertex(ndc[1], ndc[2], r, g, b, a));
+  txts[slot] = TS_Texture();
+
+  dscImgInfos[slot] = vk::DescriptorImageInfo();
+  dscImgInfos[slot].sampler = nullptr;
+  dscImgInfos[slot].imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  dscImgInfos[slot].imageView = placeholderView;
 
-  // update indices
-  TS_Add4Indices();
+  availableInds.push(slot);
+
+  TS_VkInvalidateDescriptorSets();
 }
 
-void TS_VkCmdDrawSprite(const char * img, float r, float g, float b, float a, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy)
+bool TS_SkylineFits(const std::vector<TS_SkylineNode> &skyline, size_t i, int32_t wdth, int32_t hght, int32_t size, int32_t &y)
 {
-  int txtInd = TS_VkLoadTexture(img);
+  if (skyline[i].x + wdth > size) return false;
 
-  TS_Texture txt = txts[txtInd];
-
-  uint32_t w = txt.width;
-  uint32_t h = txt.height;
+  // the rectangle rests on the highest node it spans
+  y = skyline[i].y;
+  for (int32_t widthLeft = wdth; widthLeft > 0; widthLeft -= skyline[i++].width)
+  {
+    y = std::max(y, skyline[i].y);
+    if (y + hght > size) return false;
+  }
 
-  uint32_t srcw, srch, dstw, dsth, srctlx, srctly;
+  return true;
+}
 
-  // using a specific region
+bool TS_SkylinePack(std::vector<TS_SkylineNode> &skyline, int32_t size, int32_t wdth, int32_t hght, int32_t &x, int32_t &y)
+{
+  // bottom-left heuristic: lowest resulting top edge, ties go to the narrowest node
+  int best = -1;
+  int32_t bestTop = size + 1;
+  int32_t bestWidth = size + 1;
+  for (size_t i = 0; i < skyline.size(); ++i)
+  {
+    int32_t fitY;
+    if (!TS_SkylineFits(skyline, i, wdth, hght, size, fitY)) continue;
+    if (fitY + hght < bestTop || (fitY + hght == bestTop && skyline[i].width < bestWidth))
+    {
+      best = i;
+      bestTop = fitY + hght;
+      bestWidth = skyline[i].width;
+      y = fitY;
+    }
+  }
+
+  if (best == -1) return false;
+  x = skyline[best].x;
+
+  // raise the skyline under the rectangle, then trim the nodes it now covers
+  skyline.insert(skyline.begin() + best, {x, y + hght, wdth});
+  for (size_t i = best + 1; i < skyline.size();)
+  {
+    int32_t covered = skyline[i - 1].x + skyline[i - 1].width - skyline[i].x;
+    if (covered <= 0) break;
+    if (covered < skyline[i].width)
+    {
+      skyline[i].x += covered;
+      skyline[i].width -= covered;
+      break;
+    }
+    skyline.erase(skyline.begin() + i);
+  }
+
+  // merge neighbours of equal height
+  for (size_t i = 0; i + 1 < skyline.size();)
+  {
+    if (skyline[i].y == skyline[i + 1].y)
+    {
+      skyline[i].width += skyline[i + 1].width;
+      skyline.erase(skyline.begin() + i + 1);
+    }
+    else
+    {
+      ++i;
+    }
+  }
+
+  return true;
+}
+
+void * TS_VkCreateTexture(int txtInd, uint32_t wdth, uint32_t hght)
+{
+  TS_TextureRegion &region = txtRegions[txtInd];
+  vk::ImageLayout oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  int slot = -1;
+
+  if (wdth <= TS_ATLAS_MAX_IMAGE_SIZE && hght <= TS_ATLAS_MAX_IMAGE_SIZE)
+  {
+    // padding keeps neighbouring images apart, so a sprite never picks up texels of another one
+    int32_t paddedw = wdth + TS_ATLAS_PADDING;
+    int32_t paddedh = hght + TS_ATLAS_PADDING;
+    for (int i = 0; i < NUM_SUPPORTED_TEXTURES && slot == -1; ++i)
+    {
+      if (txts[i].atlas && TS_SkylinePack(txts[i].skyline, TS_ATLAS_PAGE_SIZE, paddedw, paddedh, region.x, region.y)) slot = i;
+    }
+
+    // all pages are full, start a new one
+    if (slot == -1)
+    {
+      slot = TS_VkAllocateTextureSlot(TS_ATLAS_PAGE_SIZE, TS_ATLAS_PAGE_SIZE, true);
+      if (slot == -1) return nullptr;
+      TS_SkylinePack(txts[slot].skyline, TS_ATLAS_PAGE_SIZE, paddedw, paddedh, region.x, region.y);
+      oldLayout = vk::ImageLayout::eUndefined;
+    }
+  }
+  else
+  {
+    slot = TS_VkAllocateTextureSlot(wdth, hght, false);
+    if (slot == -1) return nullptr;
+    region.x = 0;
+    region.y = 0;
+    oldLayout = vk::ImageLayout::eUndefined;
+  }
+
+  ++txts[slot].refs;
+  region.slot = slot;
+  region.width = wdth;
+  region.height = hght;
+  region.resident = true;
+  ++residencyChanges;
+
+  // the copy is recorded into the next frame's command buffer instead of stalling here,
+  // so the caller can still write the pixels after the upload has been queued
+  vk::Buffer stagingBuf;
+  vk::DeviceSize stagingOffset;
+  void * pixels = TS_VmaStageUpload(vk::DeviceSize(wdth) * hght * 4, stagingBuf, stagingOffset);
+  TS_VkQueueImageUpload(txts[slot].img.first, oldLayout, stagingBuf, stagingOffset, region.x, region.y, wdth, hght);
+
+  return pixels;
+}
+
+int TS_VkTextureHandle(int txtInd)
+{
+  if (txtInd < 0) return -1;
+  return txtInd | int((txtRegions[txtInd].generation & TS_TEXTURE_HANDLE_GENERATION_MASK) << TS_TEXTURE_HANDLE_INDEX_BITS);
+}
+
+int TS_VkTextureHandleIndex(int handle)
+{
+  if (handle < 0) return -1;
+
+  int txtInd = handle & ((1 << TS_TEXTURE_HANDLE_INDEX_BITS) - 1);
+  if (txtInd >= int(txtRegions.size())) return -1;
+
+  // the region was unloaded or reassigned since the handle was given out
+  uint32_t generation = uint32_t(handle) >> TS_TEXTURE_HANDLE_INDEX_BITS;
+  if ((txtRegions[txtInd].generation & TS_TEXTURE_HANDLE_GENERATION_MASK) != generation) return -1;
+
+  return txtInd;
+}
+
+int TS_VkAllocateTextureRegion(const char * img)
+{
+  TS_VkInitTextureSlots();
+
+  int txtInd;
+  if (availableRegions.empty())
+  {
+    // the index has to fit below the generation of a handle
+    if (txtRegions.size() >= (size_t(1) << TS_TEXTURE_HANDLE_INDEX_BITS))
+    {
+      std::cerr << "Failed to load texture " << img << ": too many textures are loaded" << std::endl;
+      return -1;
+    }
+    txtInd = txtRegions.size();
+    txtRegions.push_back(TS_TextureRegion());
+  }
+  else
+  {
+    txtInd = availableRegions.front();
+    availableRegions.pop();
+  }
+
+  // bumped whenever a region is reassigned, so stale background decodes can be recognized
+  uint32_t generation = txtRegions[txtInd].generation + 1;
+  txtRegions[txtInd] = TS_TextureRegion();
+  txtRegions[txtInd].generation = generation;
+  txtRegions[txtInd].fname = std::string(img);
+
+  TS_TextureTableInsert(img, txtInd);
+
+  return txtInd;
+}
+
+int TS_VkLoadTexture(const char * img)
+{
+  TS_VkInitTextureSlots();
+
+  // key present means texture already loaded, or still being decoded in the background
+  int existing = TS_TextureTableFind(img);
+  if (existing != -1)
+  {
+    return TS_VkTextureHandle(existing);
+  }
+
+  SDL_Surface *srf = TS_LoadSurface(img);
+  if (srf == NULL)
+  {
+    std::cerr << "Failed to load texture " << img << ": " << IMG_GetError() << std::endl;
+    return -1;
+  }
+
+  // decode straight into staging memory
+  int txtInd = TS_VkAllocateTextureRegion(img);
+  if (txtInd == -1)
+  {
+    SDL_FreeSurface(srf);
+    return -1;
+  }
+
+  uint8_t * pixels = (uint8_t*)TS_VkCreateTexture(txtInd, srf->w, srf->h);
+  if (pixels != nullptr)
+  {
+    TS_CopySurfacePixels(srf, pixels);
+  }
+  SDL_FreeSurface(srf);
+
+  // max textures allocated
+  if (pixels == nullptr)
+  {
+    TS_VkUnloadTexture(img);
+    return -1;
+  }
+
+  return TS_VkTextureHandle(txtInd);
+}
+
+void TS_DecodeWorker()
+{
+  while (true)
+  {
+    TS_DecodeJob job;
+    {
+      std::unique_lock<std::mutex> lock(decodeMutex);
+      decodeCv.wait(lock, []() { return decodeQuit || !decodeJobs.empty(); });
+      if (decodeQuit) return;
+      job = decodeJobs.front();
+      decodeJobs.pop();
+    }
+
+    TS_DecodedImage result;
+    result.txtInd = job.txtInd;
+    result.generation = job.generation;
+    result.ok = TS_DecodeImage(job.path.c_str(), result.pixels, result.width, result.height);
+    if (!result.ok) result.error = IMG_GetError();
+
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    decodedImages.push_back(std::move(result));
+  }
+}
+
+void TS_VkStartDecodeWorkers()
+{
+  if (!decodeWorkers.empty()) return;
+
+  // leave one core to the render thread
+  int n = CLAMP(int(std::thread::hardware_concurrency()) - 1, 1, 4);
+  decodeQuit = false;
+  for (int i = 0; i < n; ++i)
+  {
+    decodeWorkers.push_back(std::thread(TS_DecodeWorker));
+  }
+}
+
+void TS_VkStopDecodeWorkers()
+{
+  {
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    decodeQuit = true;
+  }
+  decodeCv.notify_all();
+
+  for (std::thread &t : decodeWorkers)
+  {
+    t.join();
+  }
+  decodeWorkers.clear();
+
+  decodeJobs = std::queue<TS_DecodeJob>();
+  decodedImages.clear();
+  decodeQuit = false;
+}
+
+int TS_VkLoadTextureAsync(const char * img, TS_TextureReadyCallback callback, void * userData)
+{
+  int existing = TS_TextureTableFind(img);
+  if (existing != -1)
+  {
+    int txtInd = existing;
+    if (callback != nullptr)
+    {
+      if (txtRegions[txtInd].failed)
+        callback(img, -1, userData);
+      else if (txtRegions[txtInd].resident)
+        callback(img, TS_VkTextureHandle(txtInd), userData);
+      else
+        txtRegions[txtInd].callbacks.push_back(std::make_pair(callback, userData));
+    }
+    return TS_VkTextureHandle(txtInd);
+  }
+
+  // the region is placed once the size of the image is known
+  int txtInd = TS_VkAllocateTextureRegion(img);
+  if (txtInd == -1)
+  {
+    if (callback != nullptr) callback(img, -1, userData);
+    return -1;
+  }
+
+  uint32_t generation = txtRegions[txtInd].generation;
+  if (callback != nullptr)
+  {
+    txtRegions[txtInd].callbacks.push_back(std::make_pair(callback, userData));
+  }
+
+  TS_VkStartDecodeWorkers();
+  {
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    decodeJobs.push({txtInd, generation, std::string(img)});
+  }
+  decodeCv.notify_one();
+
+  return TS_VkTextureHandle(txtInd);
+}
+
+bool TS_VkIsTextureResident(int txtInd)
+{
+  int ind = TS_VkTextureHandleIndex(txtInd);
+  return ind != -1 && txtRegions[ind].resident;
+}
+
+void TS_VkUnloadTexture(const char * img)
+{
+  // retrieve index from table
+  int ind = TS_TextureTableFind(img);
+
+  // texture was never loaded
+  if (ind == -1) return;
+
+  // remove from table, before the region and the path it holds are reset
+  TS_TextureTableErase(img);
+
+  // an atlas page is only freed once none of its regions are in use,
+  // space inside a page is not reclaimed before that
+  if (txtRegions[ind].slot != -1)
+  {
+    TS_VkReleaseTextureSlot(txtRegions[ind].slot);
+  }
+
+  // reset region, keeping its generation so stale background decodes are recognized
+  uint32_t generation = txtRegions[ind].generation + 1;
+  txtRegions[ind] = TS_TextureRegion();
+  txtRegions[ind].generation = generation;
+
+  // return index to queue
+  availableRegions.push(ind);
+  ++residencyChanges;
+}
+
+void TS_VkProcessDecodedTextures()
+{
+  std::vector<TS_DecodedImage> done;
+  {
+    std::lock_guard<std::mutex> lock(decodeMutex);
+    done.swap(decodedImages);
+  }
+
+  for (TS_DecodedImage &d : done)
+  {
+    // texture was unloaded while it was being decoded
+    if (d.generation != txtRegions[d.txtInd].generation) continue;
+
+    std::string path = txtRegions[d.txtInd].fname;
+    std::vector<std::pair<TS_TextureReadyCallback, void*>> callbacks;
+    callbacks.swap(txtRegions[d.txtInd].callbacks);
+
+    int txtInd = d.txtInd;
+    void * pixels = d.ok ? TS_VkCreateTexture(txtInd, d.width, d.height) : nullptr;
+    if (pixels != nullptr)
+    {
+      memcpy(pixels, d.pixels.data(), d.pixels.size());
+      txtInd = TS_VkTextureHandle(txtInd);
+    }
+    else
+    {
+      // keep the region and its table entry, so the path is not decoded again every time it is drawn
+      // and handles to it stay valid until the caller unloads it
+      std::cerr << "Failed to load texture " << path << ": " << (d.ok ? "all texture slots are in use" : d.error) << std::endl;
+      txtRegions[txtInd].failed = true;
+      ++residencyChanges;
+      txtInd = -1;
+    }
+
+    for (auto &cb : callbacks)
+    {
+      cb.first(path.c_str(), txtInd, cb.second);
+    }
+  }
+}
+
+void TS_VkCreatePlaceholderTexture()
+{
+  // fully transparent, so sprites that are still loading simply do not show up
+  const uint8_t pixel[] = {255, 255, 255, 0};
+
+  vk::Buffer stagingBuf;
+  vk::DeviceSize stagingOffset;
+  memcpy(TS_VmaStageUpload(sizeof(pixel), stagingBuf, stagingOffset), pixel, sizeof(pixel));
+  placeholderImg = TS_VmaCreateImage(1, 1, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal);
+  TS_VkQueueImageUpload(placeholderImg.first, vk::ImageLayout::eUndefined, stagingBuf, stagingOffset, 0, 0, 1, 1);
+  placeholderView = TS_VkCreateImageView(placeholderImg.first, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
+
+  for (int i = 0; i < NUM_SUPPORTED_TEXTURES; ++i)
+  {
+    if (txts[i].view) continue;
+    dscImgInfos[i] = vk::DescriptorImageInfo();
+    dscImgInfos[i].sampler = nullptr;
+    dscImgInfos[i].imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    dscImgInfos[i].imageView = placeholderView;
+  }
+  TS_VkInvalidateDescriptorSets();
+}
+
+void TS_VkDestroyPlaceholderTexture()
+{
+  dev.destroyImageView(placeholderView);
+  al.destroyImage(placeholderImg.first, placeholderImg.second);
+}
+
+void TS_AddToBatch(bool instanced, TS_BlendMode blend, uint32_t quad)
+{
+  // consecutive quads with the same pipeline share a draw call
+  if (!drawBatches.empty())
+  {
+    TS_DrawBatch &last = drawBatches.back();
+    if (last.staticBatch < 0 && !last.tilemap && !last.clearDepth && last.instanced == instanced && last.blend == blend && last.first + last.count == quad)
+    {
+      ++last.count;
+      return;
+    }
+  }
+  drawBatches.push_back({instanced, blend, quad, 1, -1, glm::vec2(0.0f), 0.0f, false, false});
+}
+
+uint64_t TS_MakeDrawKey(const TS_QuadCommand &cmd, uint32_t seq)
+{
+  uint64_t layer = uint64_t(cmd.layer - TS_MIN_LAYER) & 0xffff;
+
+  // blended quads come last, in painter's order
+  if (cmd.blend != TS_BLEND_MODE_OPAQUE)
+  {
+    return (1ull << 63) | (layer << 47) | uint64_t(seq);
+  }
+
+  // every quad has a depth of its own so opaque quads may go in any order. front to back rejects
+  // the most pixels, within a layer quads are grouped by pipeline and texture
+  uint64_t pipeline = (uint64_t(cmd.instanced) << 2) | uint64_t(cmd.blend);
+  uint64_t texture = uint64_t(cmd.tex + 1) & 0xff;
+  return ((layer ^ 0xffff) << 47) | (pipeline << 44) | (texture << 36) | uint64_t(~seq);
+}
+
+void TS_RadixSortDrawKeys(std::vector<TS_DrawKey> &keys, std::vector<TS_DrawKey> &scratch)
+{
+  if (keys.size() < 2) return;
+
+  // least significant byte first, each pass is stable. bytes all keys share are skipped,
+  // which is most of them when only a few layers and pipelines are used
+  scratch.resize(keys.size());
+  for (int shift = 0; shift < 64; shift += 8)
+  {
+    uint32_t counts[256] = {0};
+    for (const TS_DrawKey &k : keys)
+    {
+      ++counts[(k.key >> shift) & 0xff];
+    }
+    if (counts[(keys[0].key >> shift) & 0xff] == keys.size()) continue;
+
+    uint32_t offset = 0;
+    for (uint32_t &count : counts)
+    {
+      uint32_t n = count;
+      count = offset;
+      offset += n;
+    }
+    for (const TS_DrawKey &k : keys)
+    {
+      scratch[counts[(k.key >> shift) & 0xff]++] = k;
+    }
+    keys.swap(scratch);
+  }
+}
+
+void TS_EmitQuad(const TS_QuadCommand &cmd, float depth)
+{
+  const std::array<float, 4> &ndc = cmd.ndc;
+  const std::array<float, 4> &ntc = cmd.ntc;
+  float r = cmd.col.r, g = cmd.col.g, b = cmd.col.b, a = cmd.col.a;
+
+  if (cmd.instanced)
+  {
+    TS_Instance inst;
+    inst.rect = glm::vec4(ndc[0], ndc[2], ndc[1], ndc[3]);
+    inst.uv[0] = TS_PackUnorm16(ntc[0]);
+    inst.uv[1] = TS_PackUnorm16(ntc[2]);
+    inst.uv[2] = TS_PackUnorm16(ntc[1]);
+    inst.uv[3] = TS_PackUnorm16(ntc[3]);
+    inst.col[0] = TS_PackUnorm8(r);
+    inst.col[1] = TS_PackUnorm8(g);
+    inst.col[2] = TS_PackUnorm8(b);
+    inst.col[3] = TS_PackUnorm8(a);
+    inst.tex = int16_t(cmd.tex);
+    inst.depth = TS_PackUnorm16(depth);
+    TS_AddToBatch(true, cmd.blend, static_cast<uint32_t>(instances.size()));
+    instances.push_back(inst);
+    return;
+  }
+
+  TS_AddToBatch(false, cmd.blend, static_cast<uint32_t>(vertices.size() / 4));
+
+  // update vertices
+  vertices.push_back(TS_Vertex(ndc[1], ndc[3], r, g, b, a, ntc[1], ntc[3], cmd.tex, depth));
+  vertices.push_back(TS_Vertex(ndc[0], ndc[3], r, g, b, a, ntc[0], ntc[3], cmd.tex, depth));
+  vertices.push_back(TS_Vertex(ndc[0], ndc[2], r, g, b, a, ntc[0], ntc[2], cmd.tex, depth));
+  vertices.push_back(TS_Vertex(ndc[1], ndc[2], r, g, b, a, ntc[1], ntc[2], cmd.tex, depth));
+
+  // update indices, triangle lists use the static quad index buffer instead
+  if (triangleFans)
+  {
+    TS_Add4Indices();
+  }
+}
+
+void TS_VkPushQuad(const std::array<float, 4> &ndc, const std::array<float, 4> &ntc, float r, float g, float b, float a, int tex)
+{
+  // quads entirely outside the viewport never reach the streams, mirrored sprites have their edges swapped
+  if (std::max(ndc[0], ndc[1]) < -1.0f || std::min(ndc[0], ndc[1]) > 1.0f ||
+      std::max(ndc[2], ndc[3]) < -1.0f || std::min(ndc[2], ndc[3]) > 1.0f)
+  {
+    ++culledQuads;
+    return;
+  }
+
+  TS_QuadCommand cmd;
+  cmd.ndc = ndc;
+  cmd.ntc = ntc;
+  cmd.col = glm::vec4(r, g, b, a);
+  cmd.tex = tex;
+  cmd.layer = drawLayer;
+  cmd.layerSeq = layerCounts[drawLayer]++;
+  cmd.blend = blendMode;
+  cmd.instanced = instancedDrawing;
+  cmd.staticBatch = -1;
+  cmd.offset = glm::vec2(0.0f);
+  cmd.tilemap = -1;
+
+  uint32_t seq = static_cast<uint32_t>(quadCommands.size());
+  drawKeys.push_back({TS_MakeDrawKey(cmd, seq), seq});
+  quadCommands.push_back(cmd);
+}
+
+bool TS_VkGetTilemapDraw(const TS_QuadCommand &cmd, float depth, TS_TilemapPushConstants &draw)
+{
+  auto found = tilemapsById.find(cmd.tilemap);
+  if (found == tilemapsById.end()) return false;
+
+  // the tileset may still be decoding
+  TS_Tilemap &map = found->second;
+  if (!TS_VkIsTextureResident(map.tileset)) return false;
+
+  const TS_TextureRegion &region = txtRegions[TS_VkTextureHandleIndex(map.tileset)];
+  const TS_Texture &txt = txts[region.slot];
+  int32_t columns = region.width / map.tileWidth;
+  int32_t rows = region.height / map.tileHeight;
+  if (columns == 0 || rows == 0)
+  {
+    if (!map.tilesetReported)
+    {
+      std::cerr << "Tilemap " << cmd.tilemap << " is not drawn: tileset " << region.fname << " (" << region.width << "x" << region.height
+                << ") is smaller than one " << map.tileWidth << "x" << map.tileHeight << " tile" << std::endl;
+      map.tilesetReported = true;
+    }
+    return false;
+  }
+
+  // a negative scale mirrors the map, the edges are swapped and so are the tile coordinates between them.
+  // nan or zero sized maps are not drawn
+  float l = cmd.ndc[0], r = cmd.ndc[1], t = cmd.ndc[2], b = cmd.ndc[3];
+  if (!(l < r || r < l) || !(t < b || b < t)) return false;
+  float sl = std::min(l, r), sr = std::max(l, r), st = std::min(t, b), sb = std::max(t, b);
+  if (sr < -1.0f || sl > 1.0f || sb < -1.0f || st > 1.0f)
+  {
+    ++culledQuads;
+    return false;
+  }
+
+  // only the visible part of the map is rasterized, however large the map is.
+  // the rect keeps its winding, mirroring comes from the tile coordinates decreasing across it
+  float cl = std::max(sl, -1.0f), cr = std::min(sr, 1.0f), ct = std::max(st, -1.0f), cb = std::min(sb, 1.0f);
+  float tx = map.width / (r - l), ty = map.height / (b - t);
+
+  draw.rect = glm::vec4(cl, ct, cr, cb);
+  draw.tiles = glm::vec4((cl - l) * tx, (ct - t) * ty, (cr - l) * tx, (cb - t) * ty);
+  draw.tileset = glm::vec4(float(region.x) / txt.width, float(region.y) / txt.height,
+                           float(map.tileWidth) / txt.width, float(map.tileHeight) / txt.height);
+  draw.col = cmd.col;
+  draw.depth = depth;
+  draw.map = map.slot;
+  draw.tilesetSlot = region.slot;
+  draw.columns = columns;
+  draw.count = columns * rows;
+  return true;
+}
+
+void TS_VkBuildDrawBatches()
+{
+  // turn the per layer counts into the rank of each layer's first quad in painter's order
+  uint32_t base = 0;
+  for (auto &layer : layerCounts)
+  {
+    uint32_t count = layer.second;
+    layer.second = base;
+    base += count;
+  }
+
+  TS_RadixSortDrawKeys(drawKeys, drawKeysScratch);
+
+  // frames with more quads than there are depths are split into ranges of painter's order, drawn back
+  // to front with the depth buffer cleared in between. the sort order is kept within each range
+  bool split = quadCommands.size() > TS_DEPTH_RANKS;
+  if (split)
+  {
+    uint32_t ranges = static_cast<uint32_t>((quadCommands.size() + TS_DEPTH_RANKS - 1) / TS_DEPTH_RANKS);
+    std::vector<uint32_t> counts(ranges + 1, 0);
+    for (const TS_DrawKey &key : drawKeys)
+    {
+      const TS_QuadCommand &cmd = quadCommands[key.cmd];
+      ++counts[(layerCounts[cmd.layer] + cmd.layerSeq) / TS_DEPTH_RANKS + 1];
+    }
+    for (uint32_t i = 1; i <= ranges; ++i)
+    {
+      counts[i] += counts[i - 1];
+    }
+    drawKeysScratch.resize(drawKeys.size());
+    for (const TS_DrawKey &key : drawKeys)
+    {
+      const TS_QuadCommand &cmd = quadCommands[key.cmd];
+      drawKeysScratch[counts[(layerCounts[cmd.layer] + cmd.layerSeq) / TS_DEPTH_RANKS]++] = key;
+    }
+    drawKeys.swap(drawKeysScratch);
+  }
+
+  // quads painted later are closer, the depth test resolves what the sort reordered.
+  // opaque quads only pass on a smaller depth, so no two quads of a range may share one
+  uint32_t range = 0;
+  auto layer = layerCounts.end();
+  for (const TS_DrawKey &key : drawKeys)
+  {
+    const TS_QuadCommand &cmd = quadCommands[key.cmd];
+    if (layer == layerCounts.end() || layer->first != cmd.layer) layer = layerCounts.find(cmd.layer);
+
+    uint32_t rank = layer->second + cmd.layerSeq;
+    if (split && rank / TS_DEPTH_RANKS != range)
+    {
+      range = rank / TS_DEPTH_RANKS;
+      drawBatches.push_back({false, TS_BLEND_MODE_OPAQUE, 0, 0, -1, glm::vec2(0.0f), 0.0f, false, true});
+    }
+    float depth = float(TS_DEPTH_RANKS - rank % TS_DEPTH_RANKS) / 65535.0f;
+    if (cmd.tilemap >= 0)
+    {
+      TS_TilemapPushConstants draw;
+      if (TS_VkGetTilemapDraw(cmd, depth, draw))
+      {
+        drawBatches.push_back({false, cmd.blend, static_cast<uint32_t>(tilemapDraws.size()), 1, -1, glm::vec2(0.0f), depth, true, false});
+        tilemapDraws.push_back(draw);
+      }
+      continue;
+    }
+
+    if (cmd.staticBatch < 0)
+    {
+      TS_EmitQuad(cmd, depth);
+      continue;
+    }
+
+    // static batches are one draw of their own, all their quads share the command's depth
+    // and their pipelines pass on equal depth, so they keep their order within the batch
+    auto found = staticBatchesById.find(cmd.staticBatch);
+    if (found == staticBatchesById.end() || found->second.count == 0) continue;
+
+    const TS_StaticBatch &batch = found->second;
+    if (batch.bounds[1] + cmd.offset.x < -1.0f || batch.bounds[0] + cmd.offset.x > 1.0f ||
+        batch.bounds[3] + cmd.offset.y < -1.0f || batch.bounds[2] + cmd.offset.y > 1.0f)
+    {
+      culledQuads += batch.count;
+      continue;
+    }
+    drawBatches.push_back({true, cmd.blend, 0, batch.count, cmd.staticBatch, cmd.offset, depth, false, false});
+  }
+}
+
+void TS_VkCmdDrawRect(float r, float g, float b, float a, float x, float y, float w, float h)
+{
+  // convert from screen space to normalized device coordinates
+  std::array<float, 4> ndc = TS_NDCRect(x, y, w, h);
+
+  TS_VkPushQuad(ndc, std::array<float, 4>({0, 0, 0, 0}), r, g, b, a, -1);
+}
+
+int TS_VkRegisterTexture(const char * img)
+{
+  return TS_VkLoadTextureAsync(img, nullptr, nullptr);
+}
+
+bool TS_VkGetSpriteQuad(int txtInd, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy, std::array<float, 4> &ndc, std::array<float, 4> &ntc, int &slot)
+{
+  // invalid or stale handle, or still being decoded so its size is not known yet
+  if (!TS_VkIsTextureResident(txtInd)) return false;
+
+  const TS_TextureRegion &region = txtRegions[TS_VkTextureHandleIndex(txtInd)];
+  const TS_Texture &txt = txts[region.slot];
+
+  uint32_t w = region.width;
+  uint32_t h = region.height;
+
+  uint32_t srcw, srch, dstw, dsth, srctlx, srctly;
+
+  // using a specific region
   if (rw != 0 && rh != 0)
   {
-    srctlx = rx;
-    srctly = ry;
-    srcw = rw;
-    srch = rh;
-    dstw = rw;
-    dsth = rh;
+    srctlx = rx;
+    srctly = ry;
+    srcw = rw;
+    srch = rh;
+    dstw = rw;
+    dsth = rh;
+  }
+  // divide texture into cells and use specific cell
+  else if (cw != 0 && ch != 0)
+  {
+    srctlx = cj * cw;
+    srctly = ci * ch;
+    srcw = cw;
+    srch = ch;
+    dstw = cw;
+    dsth = ch;
+  }
+  // use whole texture
+  else
+  {
+    srctlx = 0;
+    srctly = 0;
+    srcw = w;
+    srch = h;
+    dstw = w;
+    dsth = h;
+  }
+
+  // apply scaling
+  dstw = floor(dstw * sx);
+  dsth = floor(dsth * sy);
+
+  // normalized device coordinates
+  ndc = TS_NDCRect(px, py, dstw, dsth);
+
+  // normalized texture coordinates, relative to the atlas page the image was packed into
+  ntc = TS_NTCRect(region.x + srctlx, region.y + srctly, srcw, srch, txt.width, txt.height);
+
+  slot = region.slot;
+  return true;
+}
+
+void TS_VkCmdDrawSpriteH(int txtInd, float r, float g, float b, float a, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy)
+{
+  std::array<float, 4> ndc, ntc;
+  int slot;
+  if (!TS_VkGetSpriteQuad(txtInd, rx, ry, rw, rh, cw, ch, ci, cj, px, py, sx, sy, ndc, ntc, slot)) return;
+
+  TS_VkPushQuad(ndc, ntc, r, g, b, a, slot);
+}
+
+void TS_VkCmdDrawSprite(const char * img, float r, float g, float b, float a, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy)
+{
+  TS_VkCmdDrawSpriteH(TS_VkRegisterTexture(img), r, g, b, a, rx, ry, rw, rh, cw, ch, ci, cj, px, py, sx, sy);
+}
+
+void TS_VkDestroyStaticBatch(int batch)
+{
+  auto found = staticBatchesById.find(batch);
+  if (found == staticBatchesById.end()) return;
+
+  // frames in flight may still draw the buffer
+  if (found->second.count > 0)
+  {
+    std::pair<vk::Buffer, vma::Allocation> buffer = found->second.buffer;
+    TS_VkDeferDestroy([buffer]() { al.destroyBuffer(buffer.first, buffer.second); });
+  }
+  staticBatchesById.erase(found);
+}
+
+void TS_VkCreateStaticBatch(int batch)
+{
+  TS_VkDestroyStaticBatch(batch);
+
+  TS_StaticBatch &b = staticBatchesById[batch];
+  b.count = 0;
+  b.bounds = {0, 0, 0, 0};
+  b.dirty = false;
+  b.waitingSince = 0;
+}
+
+void TS_VkStaticBatchAddRect(int batch, float r, float g, float b, float a, float x, float y, float w, float h)
+{
+  auto found = staticBatchesById.find(batch);
+  if (found == staticBatchesById.end()) return;
+
+  TS_StaticQuad quad = {-1, glm::vec4(r, g, b, a), 0, 0, 0, 0, 0, 0, 0, 0, x, y, w, h};
+  found->second.quads.push_back(quad);
+  found->second.dirty = true;
+}
+
+void TS_VkStaticBatchAddSprite(int batch, int txtInd, float r, float g, float b, float a, int rx, int ry, int rw, int rh, int cw, int ch, int ci, int cj, float px, float py, float sx, float sy)
+{
+  auto found = staticBatchesById.find(batch);
+  if (found == staticBatchesById.end() || txtInd < 0) return;
+
+  TS_StaticQuad quad = {txtInd, glm::vec4(r, g, b, a), rx, ry, rw, rh, cw, ch, ci, cj, px, py, sx, sy};
+  found->second.quads.push_back(quad);
+  found->second.dirty = true;
+}
+
+bool TS_VkBuildStaticBatch(TS_StaticBatch &batch, std::vector<TS_Instance> &built)
+{
+  // sprites whose texture failed to load or was unloaded will never become resident, drop them
+  auto lost = std::remove_if(batch.quads.begin(), batch.quads.end(), [](const TS_StaticQuad &quad) {
+    if (quad.txtInd < 0) return false;
+    int ind = TS_VkTextureHandleIndex(quad.txtInd);
+    if (ind != -1 && !txtRegions[ind].failed) return false;
+    std::cerr << "Dropping static batch sprite: texture " << quad.txtInd << " failed to load or was unloaded" << std::endl;
+    return true;
+  });
+  batch.quads.erase(lost, batch.quads.end());
+
+  // the bounds of the current buffer stay in use until the new one is complete
+  std::array<float, 4> bounds = {0, 0, 0, 0};
+  built.clear();
+  built.reserve(batch.quads.size());
+  for (const TS_StaticQuad &quad : batch.quads)
+  {
+    std::array<float, 4> ndc;
+    std::array<float, 4> ntc = {0, 0, 0, 0};
+    int slot = -1;
+    if (quad.txtInd < 0)
+    {
+      ndc = TS_NDCRect(quad.x, quad.y, quad.w, quad.h);
+    }
+    // sprites need the size and atlas placement of their texture, try again next frame
+    else if (!TS_VkGetSpriteQuad(quad.txtInd, quad.rx, quad.ry, quad.rw, quad.rh, quad.cw, quad.ch, quad.ci, quad.cj,
+                                 quad.x, quad.y, quad.w, quad.h, ndc, ntc, slot))
+    {
+      return false;
+    }
+
+    TS_Instance inst;
+    inst.rect = glm::vec4(ndc[0], ndc[2], ndc[1], ndc[3]);
+    inst.uv[0] = TS_PackUnorm16(ntc[0]);
+    inst.uv[1] = TS_PackUnorm16(ntc[2]);
+    inst.uv[2] = TS_PackUnorm16(ntc[1]);
+    inst.uv[3] = TS_PackUnorm16(ntc[3]);
+    inst.col[0] = TS_PackUnorm8(quad.col.r);
+    inst.col[1] = TS_PackUnorm8(quad.col.g);
+    inst.col[2] = TS_PackUnorm8(quad.col.b);
+    inst.col[3] = TS_PackUnorm8(quad.col.a);
+    inst.tex = int16_t(slot);
+    inst.depth = 0; // the push constant of each draw provides it
+    built.push_back(inst);
+
+    if (built.size() == 1)
+    {
+      bounds = {std::min(ndc[0], ndc[1]), std::max(ndc[0], ndc[1]), std::min(ndc[2], ndc[3]), std::max(ndc[2], ndc[3])};
+    }
+    else
+    {
+      bounds[0] = std::min(bounds[0], std::min(ndc[0], ndc[1]));
+      bounds[1] = std::max(bounds[1], std::max(ndc[0], ndc[1]));
+      bounds[2] = std::min(bounds[2], std::min(ndc[2], ndc[3]));
+      bounds[3] = std::max(bounds[3], std::max(ndc[2], ndc[3]));
+    }
+  }
+  batch.bounds = bounds;
+  return true;
+}
+
+void TS_VkCmdFlushStaticBatches(vk::CommandBuffer &cmdbuf)
+{
+  std::vector<TS_Instance> built;
+  std::vector<vk::BufferMemoryBarrier> barriers;
+  for (auto &entry : staticBatchesById)
+  {
+    TS_StaticBatch &batch = entry.second;
+    if (!batch.dirty) continue;
+
+    // a batch waiting for a texture is only tried again once some texture became resident
+    if (batch.waitingSince == residencyChanges) continue;
+    if (!TS_VkBuildStaticBatch(batch, built))
+    {
+      batch.waitingSince = residencyChanges;
+      continue;
+    }
+    batch.dirty = false;
+    batch.waitingSince = 0;
+
+    // frames in flight may still draw the previous buffer
+    if (batch.count > 0)
+    {
+      std::pair<vk::Buffer, vma::Allocation> old = batch.buffer;
+      TS_VkDeferDestroy([old]() { al.destroyBuffer(old.first, old.second); });
+    }
+    batch.count = static_cast<uint32_t>(built.size());
+    if (batch.count == 0) continue;
+
+    vk::DeviceSize size = built.size() * sizeof(TS_Instance);
+    batch.buffer = TS_VmaCreateBuffer(size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
+                                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::Buffer src;
+    vk::DeviceSize offset;
+    memcpy(TS_VmaStageUpload(size, src, offset), built.data(), size);
+
+    // new buffers are written by the transfer queue if there is one, see TS_VkCmdFlushUploads
+    vk::BufferCopy bfcpy;
+    bfcpy.srcOffset = offset;
+    bfcpy.dstOffset = 0;
+    bfcpy.size = size;
+    (TS_VkHasTransferQueue() ? TS_VkGetTransferCommandBuffer() : cmdbuf).copyBuffer(src, batch.buffer.first, 1, &bfcpy);
+
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = batch.buffer.first;
+    barrier.offset = 0;
+    barrier.size = size;
+    barriers.push_back(barrier);
+  }
+
+  if (barriers.empty()) return;
+
+  if (!TS_VkHasTransferQueue())
+  {
+    cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(),
+                           0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    return;
+  }
+
+  // release the buffers to the graphics queue, which acquires them in TS_VkCmdAcquireTransfers
+  for (vk::BufferMemoryBarrier &barrier : barriers)
+  {
+    barrier.srcQueueFamilyIndex = transferQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = graphicsQueueFamilyIndex;
+    vk::BufferMemoryBarrier acquire = barrier;
+    barrier.dstAccessMask = vk::AccessFlags();
+    acquire.srcAccessMask = vk::AccessFlags();
+    transferAcquireBufferBarriers.push_back(acquire);
+  }
+  TS_VkGetTransferCommandBuffer().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+                                                  0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void TS_VkDrawStaticBatch(int batch, float x, float y)
+{
+  if (staticBatchesById.find(batch) == staticBatchesById.end()) return;
+
+  // recorded like a quad so it is sorted with the rest of the frame, see TS_VkBuildDrawBatches
+  TS_QuadCommand cmd;
+  cmd.ndc = {0, 0, 0, 0};
+  cmd.ntc = {0, 0, 0, 0};
+  cmd.col = glm::vec4(0.0f);
+  cmd.tex = -1;
+  cmd.layer = drawLayer;
+  cmd.layerSeq = layerCounts[drawLayer]++;
+  cmd.blend = blendMode;
+  cmd.instanced = true;
+  cmd.staticBatch = batch;
+  cmd.offset = glm::vec2(2.0f * x / window_width, 2.0f * y / window_height);
+  cmd.tilemap = -1;
+
+  uint32_t seq = static_cast<uint32_t>(quadCommands.size());
+  drawKeys.push_back({TS_MakeDrawKey(cmd, seq), seq});
+  quadCommands.push_back(cmd);
+}
+
+void TS_VkDestroyStaticBatches()
+{
+  while (!staticBatchesById.empty()) TS_VkDestroyStaticBatch(staticBatchesById.begin()->first);
+}
+
+void TS_VkDestroyTilemap(int tilemap)
+{
+  auto found = tilemapsById.find(tilemap);
+  if (found == tilemapsById.end()) return;
+
+  TS_Tilemap &map = found->second;
+
+  // drop uploads that have not been recorded yet
+  vk::Image released = map.img.first;
+  pendingUploads.erase(std::remove_if(pendingUploads.begin(), pendingUploads.end(),
+    [released](const TS_PendingUpload &upload) { return upload.img == released; }), pendingUploads.end());
+
+  // frames in flight may still sample the tile indices
+  std::pair<vk::Image, vma::Allocation> releasedImg = map.img;
+  vk::ImageView releasedView = map.view;
+  TS_VkDeferDestroy([releasedImg, releasedView]() {
+    dev.destroyImageView(releasedView);
+    al.destroyImage(releasedImg.first, releasedImg.second);
+  });
+
+  tilemapImgInfos[map.slot] = vk::DescriptorImageInfo();
+  TS_VkInvalidateDescriptorSets();
+  tilemapsById.erase(found);
+}
+
+void TS_VkCreateTilemap(int tilemap, int width, int height, int tileset, int tile_width, int tile_height)
+{
+  TS_VkDestroyTilemap(tilemap);
+  if (width <= 0 || height <= 0 || tile_width <= 0 || tile_height <= 0) return;
+
+  int slot = -1;
+  for (int i = 0; i < TS_MAX_TILEMAPS && slot == -1; ++i)
+  {
+    if (!tilemapImgInfos[i].imageView) slot = i;
+  }
+  if (slot == -1)
+  {
+    std::cerr << "Unable to create tilemap " << tilemap << ", at most " << TS_MAX_TILEMAPS << " tilemaps may exist at once" << std::endl;
+    return;
+  }
+
+  TS_Tilemap &map = tilemapsById[tilemap];
+  map.width = width;
+  map.height = height;
+  map.tiles.assign(size_t(width) * height, 0);
+  map.img = TS_VmaCreateImage(width, height, vk::Format::eR16Uint, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal);
+  map.view = TS_VkCreateImageView(map.img.first, vk::Format::eR16Uint, vk::ImageAspectFlagBits::eColor);
+  map.layout = vk::ImageLayout::eUndefined;
+  map.slot = slot;
+  map.tileset = tileset;
+  map.tileWidth = tile_width;
+  map.tileHeight = tile_height;
+  map.tilesetReported = false;
+
+  // the whole map is uploaded once so it starts out empty
+  map.dirtyX0 = 0;
+  map.dirtyY0 = 0;
+  map.dirtyX1 = width;
+  map.dirtyY1 = height;
+
+  tilemapImgInfos[slot] = vk::DescriptorImageInfo();
+  tilemapImgInfos[slot].sampler = nullptr;
+  tilemapImgInfos[slot].imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  tilemapImgInfos[slot].imageView = map.view;
+
+  TS_VkInvalidateDescriptorSets();
+}
+
+void TS_VkSetTiles(int tilemap, int x, int y, int width, int height, const int * tiles)
+{
+  auto found = tilemapsById.find(tilemap);
+  if (found == tilemapsById.end() || tiles == nullptr) return;
+
+  TS_Tilemap &map = found->second;
+  int x0 = std::max(x, 0), y0 = std::max(y, 0);
+  int x1 = std::min(x + width, int(map.width)), y1 = std::min(y + height, int(map.height));
+  if (x0 >= x1 || y0 >= y1) return;
+
+  for (int j = y0; j < y1; ++j)
+  {
+    for (int i = x0; i < x1; ++i)
+    {
+      int tile = tiles[(j - y) * width + (i - x)];
+      map.tiles[size_t(j) * map.width + i] = uint16_t(CLAMP(tile + 1, 0, 0xffff));
+    }
+  }
+
+  // changes are uploaded together once per frame, as the rectangle covering all of them
+  if (map.dirtyX0 >= map.dirtyX1)
+  {
+    map.dirtyX0 = x0;
+    map.dirtyY0 = y0;
+    map.dirtyX1 = x1;
+    map.dirtyY1 = y1;
+  }
+  else
+  {
+    map.dirtyX0 = std::min<uint32_t>(map.dirtyX0, x0);
+    map.dirtyY0 = std::min<uint32_t>(map.dirtyY0, y0);
+    map.dirtyX1 = std::max<uint32_t>(map.dirtyX1, x1);
+    map.dirtyY1 = std::max<uint32_t>(map.dirtyY1, y1);
+  }
+}
+
+void TS_VkSetTile(int tilemap, int x, int y, int tile)
+{
+  TS_VkSetTiles(tilemap, x, y, 1, 1, &tile);
+}
+
+void TS_VkQueueTilemapUploads()
+{
+  for (auto &entry : tilemapsById)
+  {
+    TS_Tilemap &map = entry.second;
+    if (map.dirtyX0 >= map.dirtyX1) continue;
+
+    uint32_t w = map.dirtyX1 - map.dirtyX0, h = map.dirtyY1 - map.dirtyY0;
+    vk::Buffer stagingBuf;
+    vk::DeviceSize stagingOffset;
+    uint16_t * dst = static_cast<uint16_t*>(TS_VmaStageUpload(vk::DeviceSize(w) * h * sizeof(uint16_t), stagingBuf, stagingOffset));
+    for (uint32_t j = 0; j < h; ++j)
+    {
+      memcpy(dst + size_t(j) * w, &map.tiles[size_t(map.dirtyY0 + j) * map.width + map.dirtyX0], w * sizeof(uint16_t));
+    }
+    TS_VkQueueImageUpload(map.img.first, map.layout, stagingBuf, stagingOffset, map.dirtyX0, map.dirtyY0, w, h);
+
+    map.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    map.dirtyX0 = map.dirtyX1 = 0;
+    map.dirtyY0 = map.dirtyY1 = 0;
+  }
+}
+
+void TS_VkDrawTilemap(int tilemap, float r, float g, float b, float a, float x, float y, float sx, float sy)
+{
+  auto found = tilemapsById.find(tilemap);
+  if (found == tilemapsById.end()) return;
+
+  const TS_Tilemap &map = found->second;
+
+  // recorded like a quad so it is sorted with the rest of the frame, see TS_VkBuildDrawBatches
+  TS_QuadCommand cmd;
+  cmd.ndc = TS_NDCRect(x, y, map.width * map.tileWidth * sx, map.height * map.tileHeight * sy);
+  cmd.ntc = {0, 0, 0, 0};
+  cmd.col = glm::vec4(r, g, b, a);
+  cmd.tex = -1;
+  cmd.layer = drawLayer;
+  cmd.layerSeq = layerCounts[drawLayer]++;
+  cmd.blend = blendMode;
+  cmd.instanced = false;
+  cmd.staticBatch = -1;
+  cmd.offset = glm::vec2(0.0f);
+  cmd.tilemap = tilemap;
+
+  uint32_t seq = static_cast<uint32_t>(quadCommands.size());
+  drawKeys.push_back({TS_MakeDrawKey(cmd, seq), seq});
+  quadCommands.push_back(cmd);
+}
+
+void TS_VkDestroyTilemaps()
+{
+  while (!tilemapsById.empty()) TS_VkDestroyTilemap(tilemapsById.begin()->first);
+}
+
+std::map<int, TS_SpatialHash*> spatialHashesById;
+
+// items touching more cells than this are kept in a list of their own, which every query visits
+#define TS_SPATIAL_HASH_MAX_ITEM_CELLS 1024
+
+int32_t TS_SpatialHashCell(float v, float cellSize)
+{
+  return static_cast<int32_t>(CLAMP(std::floor(v / cellSize), -1073741824.0f, 1073741824.0f));
+}
+
+uint64_t TS_SpatialHashKey(int32_t cx, int32_t cy)
+{
+  return (uint64_t(uint32_t(cx)) << 32) | uint64_t(uint32_t(cy));
+}
+
+TS_SpatialHash::TS_SpatialHash(float cellSize)
+{
+  this->cellSize = cellSize > 0 ? cellSize : 1.0f;
+  this->stamp = 0;
+}
+
+void TS_SpatialHash::insert(int id, float x, float y, float w, float h)
+{
+  // a nan or infinite rectangle has no cells, it is ignored and the hash is left unchanged
+  if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(w) || !std::isfinite(h)) return;
+
+  remove(id);
+
+  uint32_t slot;
+  if (freeItems.empty())
+  {
+    slot = static_cast<uint32_t>(items.size());
+    items.push_back(TS_SpatialHashItem());
+  }
+  else
+  {
+    slot = freeItems.back();
+    freeItems.pop_back();
+  }
+  slotsById[id] = slot;
+
+  // an item is listed in every cell it touches, unless that would be so many cells
+  // that inserting and removing it costs more than checking it in every query
+  int32_t cx0 = TS_SpatialHashCell(x, cellSize), cx1 = TS_SpatialHashCell(x + w, cellSize);
+  int32_t cy0 = TS_SpatialHashCell(y, cellSize), cy1 = TS_SpatialHashCell(y + h, cellSize);
+  double span = (double(cx1) - cx0 + 1) * (double(cy1) - cy0 + 1);
+  bool oversized = span > TS_SPATIAL_HASH_MAX_ITEM_CELLS;
+  items[slot] = {id, x, y, w, h, stamp, oversized};
+  if (oversized)
+  {
+    oversizedItems.push_back(slot);
+    return;
+  }
+
+  for (int64_t cx = cx0; cx <= cx1; ++cx)
+  {
+    for (int64_t cy = cy0; cy <= cy1; ++cy)
+    {
+      cells[TS_SpatialHashKey(int32_t(cx), int32_t(cy))].push_back(slot);
+    }
+  }
+}
+
+void TS_SpatialHash::remove(int id)
+{
+  auto found = slotsById.find(id);
+  if (found == slotsById.end()) return;
+
+  uint32_t slot = found->second;
+  TS_SpatialHashItem &item = items[slot];
+  if (item.oversized)
+  {
+    auto it = std::find(oversizedItems.begin(), oversizedItems.end(), slot);
+    *it = oversizedItems.back();
+    oversizedItems.pop_back();
+  }
+  else
+  {
+    int32_t cx0 = TS_SpatialHashCell(item.x, cellSize), cx1 = TS_SpatialHashCell(item.x + item.w, cellSize);
+    int32_t cy0 = TS_SpatialHashCell(item.y, cellSize), cy1 = TS_SpatialHashCell(item.y + item.h, cellSize);
+    for (int64_t cx = cx0; cx <= cx1; ++cx)
+    {
+      for (int64_t cy = cy0; cy <= cy1; ++cy)
+      {
+        auto cell = cells.find(TS_SpatialHashKey(int32_t(cx), int32_t(cy)));
+        if (cell == cells.end()) continue;
+
+        // order within a cell does not matter, swap the slot with the last one
+        std::vector<uint32_t> &slots = cell->second;
+        auto it = std::find(slots.begin(), slots.end(), slot);
+        if (it != slots.end())
+        {
+          *it = slots.back();
+          slots.pop_back();
+        }
+        if (slots.empty()) cells.erase(cell);
+      }
+    }
+  }
+
+  item.id = -1;
+  freeItems.push_back(slot);
+  slotsById.erase(found);
+}
+
+void TS_SpatialHash::clear()
+{
+  items.clear();
+  freeItems.clear();
+  slotsById.clear();
+  cells.clear();
+  oversizedItems.clear();
+}
+
+int TS_SpatialHash::query(float x, float y, float w, float h, int * ids, int maxIds)
+{
+  if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(w) || !std::isfinite(h)) return 0;
+
+  // items spanning several cells are seen once per cell, the stamp filters the repeats
+  if (++stamp == 0)
+  {
+    for (TS_SpatialHashItem &item : items) item.stamp = 0;
+    stamp = 1;
   }
-  // divide texture into cells and use specific cell
-  else if (cw != 0 && ch != 0)
+
+  int count = 0;
+  auto visit = [&](const std::vector<uint32_t> &slots)
   {
-    srctlx = cj * cw;
-    srctly = ci * ch;
-    srcw = cw;
-    srch = ch;
-    dstw = cw;
-    dsth = ch;
+    for (uint32_t slot : slots)
+    {
+      TS_SpatialHashItem &item = items[slot];
+      if (item.stamp == stamp) continue;
+      item.stamp = stamp;
+
+      // sharing a cell does not mean overlapping the area
+      if (item.x > x + w || item.x + item.w < x || item.y > y + h || item.y + item.h < y) continue;
+
+      if (ids != nullptr && count < maxIds) ids[count] = item.id;
+      ++count;
+    }
+  };
+
+  visit(oversizedItems);
+
+  int32_t cx0 = TS_SpatialHashCell(x, cellSize), cx1 = TS_SpatialHashCell(x + w, cellSize);
+  int32_t cy0 = TS_SpatialHashCell(y, cellSize), cy1 = TS_SpatialHashCell(y + h, cellSize);
+  double area = (double(cx1) - cx0 + 1) * (double(cy1) - cy0 + 1);
+  if (area > double(cells.size()))
+  {
+    // the area covers more cells than are occupied, walking the occupied ones is cheaper
+    for (const auto &cell : cells)
+    {
+      int32_t cx = int32_t(uint32_t(cell.first >> 32)), cy = int32_t(uint32_t(cell.first));
+      if (cx >= cx0 && cx <= cx1 && cy >= cy0 && cy <= cy1) visit(cell.second);
+    }
+    return count;
   }
-  // use whole texture
-  else
+
+  for (int64_t cx = cx0; cx <= cx1; ++cx)
   {
-    srctlx = 0;
-    srctly = 0;
-    srcw = w;
-    srch = h;
-    dstw = w;
-    dsth = h;
+    for (int64_t cy = cy0; cy <= cy1; ++cy)
+    {
+      auto cell = cells.find(TS_SpatialHashKey(int32_t(cx), int32_t(cy)));
+      if (cell != cells.end()) visit(cell->second);
+    }
   }
+  return count;
+}
 
-  // apply scaling
-  dstw = floor(dstw * sx);
-  dsth = floor(dsth * sy);
+void TS_SpatialHashCreate(int hash, float cell_size)
+{
+  TS_SpatialHashDestroy(hash);
+  spatialHashesById[hash] = new TS_SpatialHash(cell_size);
+}
 
-  // normalized device coordinates
-  std::array<float, 4> ndc = TS_NDCRect(px, py, dstw, dsth);
+void TS_SpatialHashDestroy(int hash)
+{
+  auto found = spatialHashesById.find(hash);
+  if (found == spatialHashesById.end()) return;
 
-  // normalized texture coordinates
-  std::array<float, 4> ntc = TS_NTCRect(srctlx, srctly, srcw, srch, w, h);
+  delete found->second;
+  spatialHashesById.erase(found);
+}
 
-  // update vertices
-  vertices.push_back(TS_Vertex(ndc[1], ndc[3], r, g, b, a, ntc[1], ntc[3], txtInd));
-  vertices.push_back(TS_Vertex(ndc[0], ndc[3], r, g, b, a, ntc[0], ntc[3], txtInd));
-  vertices.push_back(TS_Vertex(ndc[0], ndc[2], r, g, b, a, ntc[0], ntc[2], txtInd));
-  vertices.push_back(TS_Vertex(ndc[1], ndc[2], r, g, b, a, ntc[1], ntc[2], txtInd));
+void TS_SpatialHashInsert(int hash, int id, float x, float y, float w, float h)
+{
+  auto found = spatialHashesById.find(hash);
+  if (found != spatialHashesById.end()) found->second->insert(id, x, y, w, h);
+}
+
+void TS_SpatialHashRemove(int hash, int id)
+{
+  auto found = spatialHashesById.find(hash);
+  if (found != spatialHashesById.end()) found->second->remove(id);
+}
+
+void TS_SpatialHashClear(int hash)
+{
+  auto found = spatialHashesById.find(hash);
+  if (found != spatialHashesById.end()) found->second->clear();
+}
+
+int TS_SpatialHashQuery(int hash, float x, float y, float w, float h, int * ids, int max_ids)
+{
+  auto found = spatialHashesById.find(hash);
+  if (found == spatialHashesById.end()) return 0;
 
-  // update indices
-  TS_Add4Indices();
+  return found->second->query(x, y, w, h, ids, max_ids);
 }
 
 void TS_VkCmdClearColorImage(float r, float g, float b, float a)
 {
+  if (frameSkipped) return;
+
   vk::ClearColorValue clearColor(std::array<float, 4>({r, g, b, a}));
   vk::ImageSubresourceRange imageRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
 
-  cmdbufs[frameIndex].clearColorImage(swapchainImages[frameIndex], vk::ImageLayout::eGeneral, &clearColor, 1U, &imageRange);
+  cmdbufs[currentFrame].clearColorImage(swapchainImages[frameIndex], vk::ImageLayout::eGeneral, &clearColor, 1U, &imageRange);
+}
+
+void TS_SwizzleBGRA(uint8_t * dst, const uint8_t * src, size_t size)
+{
+  // dst may be src
+  for (size_t i = 0; i < size; i += 4)
+  {
+    uint8_t b = src[i + 0];
+    dst[i + 0] = src[i + 2];
+    dst[i + 1] = src[i + 1];
+    dst[i + 2] = b;
+    dst[i + 3] = src[i + 3];
+  }
+}
+
+void TS_EncodeWorker()
+{
+  while (true)
+  {
+    TS_EncodeJob job;
+    {
+      std::unique_lock<std::mutex> lock(encodeMutex);
+      encodeCv.wait(lock, []() { return encodeQuit || !encodeJobs.empty(); });
+      // pending captures are still written when quitting
+      if (encodeJobs.empty()) return;
+      job = std::move(encodeJobs.front());
+      encodeJobs.pop();
+      ++encodeBusy;
+    }
+
+    if (job.bgra) TS_SwizzleBGRA(job.pixels.data(), job.pixels.data(), job.pixels.size());
+
+    SDL_Surface * srf = SDL_CreateRGBSurfaceWithFormatFrom(job.pixels.data(), job.width, job.height, 32, job.width * 4, SDL_PIXELFORMAT_RGBA32);
+    if (srf == NULL || IMG_SavePNG(srf, job.path.c_str()) != 0)
+    {
+      std::cerr << "Failed to write capture " << job.path << ": " << IMG_GetError() << std::endl;
+    }
+    SDL_FreeSurface(srf);
+
+    std::lock_guard<std::mutex> lock(encodeMutex);
+    encodeBuffers.push_back(std::move(job.pixels));
+    --encodeBusy;
+    encodeDoneCv.notify_all();
+  }
+}
+
+void TS_VkStartEncodeWorker()
+{
+  if (encodeWorker.joinable()) return;
+  encodeQuit = false;
+  encodeWorker = std::thread(TS_EncodeWorker);
+}
+
+void TS_VkStopEncodeWorker()
+{
+  if (!encodeWorker.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(encodeMutex);
+    encodeQuit = true;
+  }
+  encodeCv.notify_all();
+  encodeWorker.join();
+
+  encodeBuffers.clear();
+  encodeQuit = false;
+}
+
+void TS_VkCompleteReadback(const TS_Readback &readback)
+{
+  const uint8_t * src = static_cast<const uint8_t*>(al.getAllocationInfo(readbackBuffers[readback.slot].second).pMappedData);
+  size_t size = size_t(readback.width) * readback.height * 4;
+  bool bgra = surfaceFormat.format == vk::Format::eB8G8R8A8Unorm || surfaceFormat.format == vk::Format::eB8G8R8A8Srgb;
+
+  if (readback.path.empty())
+  {
+    // the pixels are handed out as RGBA whatever the format of the color image
+    if (bgra)
+      TS_SwizzleBGRA(readback.dst, src, size);
+    else
+      memcpy(readback.dst, src, size);
+    return;
+  }
+
+  // only the copy out of the readback buffer, which is reused a few frames later, happens on this thread
+  TS_EncodeJob job;
+  {
+    std::lock_guard<std::mutex> lock(encodeMutex);
+    if (encodeJobs.size() + encodeBusy >= TS_MAX_PENDING_CAPTURES)
+    {
+      // the encoder fell behind, skip the capture rather than stall the frame
+      ++droppedCaptures;
+      return;
+    }
+    if (!encodeBuffers.empty())
+    {
+      job.pixels = std::move(encodeBuffers.back());
+      encodeBuffers.pop_back();
+    }
+  }
+  job.path = readback.path;
+  job.width = readback.width;
+  job.height = readback.height;
+  job.bgra = bgra;
+  job.pixels.resize(size);
+  memcpy(job.pixels.data(), src, size);
+
+  {
+    std::lock_guard<std::mutex> lock(encodeMutex);
+    encodeJobs.push(std::move(job));
+  }
+  encodeCv.notify_one();
+}
+
+void TS_VkPollReadbacks()
+{
+  // a slot's fence is only reset once its frame is counted in completedFrames, so a signaled fence
+  // always belongs to the last frame recorded into the slot
+  auto done = std::stable_partition(pendingReadbacks.begin(), pendingReadbacks.end(), [](const TS_Readback &readback) {
+    if (!readback.recorded) return true;
+    if (readback.frameNumber < completedFrames) return false;
+    return dev.getFenceStatus(fences[readback.slot]) != vk::Result::eSuccess;
+  });
+
+  for (auto it = done; it != pendingReadbacks.end(); ++it)
+  {
+    if (!readbackCoherent[it->slot])
+    {
+      al.invalidateAllocation(readbackBuffers[it->slot].second, 0, VK_WHOLE_SIZE);
+    }
+    TS_VkCompleteReadback(*it);
+  }
+  pendingReadbacks.erase(done, pendingReadbacks.end());
+}
+
+int TS_VkRequestReadback(uint8_t * dst, const std::string &path)
+{
+  if (!swapchainReadable) return -1;
+
+  TS_Readback readback;
+  readback.ticket = nextReadbackTicket++;
+  readback.dst = dst;
+  readback.path = path;
+  readback.recorded = false;
+  readback.frameNumber = 0;
+  readback.slot = 0;
+  readback.width = swapchainSize.width;
+  readback.height = swapchainSize.height;
+  pendingReadbacks.push_back(readback);
+  return readback.ticket;
+}
+
+int TS_VkReadbackFrame(void * pixels)
+{
+  if (pixels == nullptr) return -1;
+  return TS_VkRequestReadback(static_cast<uint8_t*>(pixels), std::string());
+}
+
+int TS_VkCaptureFrame(const char * path)
+{
+  if (path == nullptr) return -1;
+  TS_VkStartEncodeWorker();
+  return TS_VkRequestReadback(nullptr, path);
+}
+
+bool TS_VkStartCapture(const char * prefix)
+{
+  if (prefix == nullptr || prefix[0] == '\0' || !swapchainReadable) return false;
+  TS_VkStartEncodeWorker();
+  capturePrefix = prefix;
+  captureCount = 0;
+  droppedCaptures = 0;
+  return true;
+}
+
+uint64_t TS_VkStopCapture()
+{
+  capturePrefix.clear();
+  return droppedCaptures;
+}
+
+bool TS_VkIsReadbackComplete(int ticket)
+{
+  TS_VkPollReadbacks();
+  for (const TS_Readback &readback : pendingReadbacks)
+  {
+    if (readback.ticket == ticket) return false;
+  }
+  return ticket > 0 && ticket < nextReadbackTicket;
+}
+
+void TS_VkWaitReadback(int ticket)
+{
+  for (const TS_Readback &readback : pendingReadbacks)
+  {
+    // frames still being recorded cannot be waited for
+    if (readback.ticket == ticket && readback.recorded)
+    {
+      dev.waitForFences(1, &fences[readback.slot], VK_FALSE, UINT64_MAX);
+      break;
+    }
+  }
+  TS_VkPollReadbacks();
+}
+
+void TS_VkGetFrameSize(int * width, int * height)
+{
+  if (width != nullptr) *width = swapchainSize.width;
+  if (height != nullptr) *height = swapchainSize.height;
+}
+
+void TS_VkFlushCaptures()
+{
+  // captures of frames not submitted yet are left pending
+  for (const TS_Readback &readback : pendingReadbacks)
+  {
+    if (readback.recorded && !readback.path.empty())
+    {
+      dev.waitForFences(1, &fences[readback.slot], VK_FALSE, UINT64_MAX);
+    }
+  }
+  TS_VkPollReadbacks();
+
+  std::unique_lock<std::mutex> lock(encodeMutex);
+  encodeDoneCv.wait(lock, []() { return encodeJobs.empty() && encodeBusy == 0; });
+}
+
+void TS_VkCmdCopyReadbacks(vk::CommandBuffer &cmdbuf)
+{
+  // continuous capture, numbered so the frames sort in order
+  if (!capturePrefix.empty())
+  {
+    char number[16];
+    snprintf(number, sizeof(number), "%06u.png", captureCount++);
+    TS_VkRequestReadback(nullptr, capturePrefix + number);
+  }
+
+  bool requested = false;
+  for (const TS_Readback &readback : pendingReadbacks)
+  {
+    requested |= !readback.recorded;
+  }
+  if (!requested) return;
+
+  vk::DeviceSize size = vk::DeviceSize(swapchainSize.width) * swapchainSize.height * 4;
+  if (readbackBuffers.size() < framesInFlight)
+  {
+    readbackBuffers.resize(framesInFlight);
+    readbackCapacities.resize(framesInFlight, 0);
+    readbackCoherent.resize(framesInFlight, true);
+  }
+  if (readbackCapacities[currentFrame] < size)
+  {
+    // earlier frames of this slot have completed, their pixels were handed out when it was acquired
+    if (readbackCapacities[currentFrame] > 0)
+    {
+      al.destroyBuffer(readbackBuffers[currentFrame].first, readbackBuffers[currentFrame].second);
+    }
+    // reading uncached memory is slow, prefer cached memory and invalidate it if it is not coherent
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    vma::AllocationCreateInfo allocInfo;
+    allocInfo.flags = vma::AllocationCreateFlagBits::eMapped;
+    allocInfo.usage = vma::MemoryUsage::eUnknown;
+    allocInfo.requiredFlags = vk::MemoryPropertyFlagBits::eHostVisible;
+    allocInfo.preferredFlags = vk::MemoryPropertyFlagBits::eHostCached | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+    readbackBuffers[currentFrame] = al.createBuffer(bufferInfo, allocInfo);
+    readbackCapacities[currentFrame] = size;
+
+    uint32_t memoryType = al.getAllocationInfo(readbackBuffers[currentFrame].second).memoryType;
+    readbackCoherent[currentFrame] = bool(pdev.getMemoryProperties().memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+  }
+
+  // the render pass leaves the image ready to present, or to copy from when headless.
+  // Its dependency to external transfers orders this barrier after the final layout transition
+  vk::ImageLayout finalLayout = headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+  vk::ImageMemoryBarrier barrier;
+  barrier.oldLayout = finalLayout;
+  barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = swapchainImages[frameIndex];
+  barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+  barrier.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+  cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+
+  vk::BufferImageCopy region;
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+  region.imageOffset = vk::Offset3D(0, 0, 0);
+  region.imageExtent = vk::Extent3D(swapchainSize.width, swapchainSize.height, 1);
+  cmdbuf.copyImageToBuffer(swapchainImages[frameIndex], vk::ImageLayout::eTransferSrcOptimal, readbackBuffers[currentFrame].first, 1, &region);
+
+  if (finalLayout != vk::ImageLayout::eTransferSrcOptimal)
+  {
+    barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+    barrier.dstAccessMask = vk::AccessFlags();
+    cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+  }
+
+  // make the copy visible to the host once the fence has signaled
+  vk::BufferMemoryBarrier hostBarrier;
+  hostBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  hostBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+  hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  hostBarrier.buffer = readbackBuffers[currentFrame].first;
+  hostBarrier.offset = 0;
+  hostBarrier.size = size;
+  cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), 0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+  for (TS_Readback &readback : pendingReadbacks)
+  {
+    if (readback.recorded) continue;
+    readback.recorded = true;
+    readback.frameNumber = frameCount;
+    readback.slot = currentFrame;
+    readback.width = swapchainSize.width;
+    readback.height = swapchainSize.height;
+  }
+}
+
+void TS_VmaDestroyReadbackBuffers()
+{
+  for (size_t i = 0; i < readbackBuffers.size(); ++i)
+  {
+    if (readbackCapacities[i] > 0) al.destroyBuffer(readbackBuffers[i].first, readbackBuffers[i].second);
+  }
+  readbackBuffers.clear();
+  readbackCapacities.clear();
+  readbackCoherent.clear();
 }
 
-void TS_VkAcquireNextImage()
+bool TS_VkAcquireNextImage()
 {
-  frameIndex = dev.acquireNextImageKHR(swapchain, UINT64_MAX, imageAvailableSemaphore).value;
-  dev.waitForFences(1, &fences[frameIndex], VK_FALSE, UINT64_MAX);
-  dev.resetFences(1, &fences[frameIndex]);
+  // only block if the gpu is still using the resources of this frame in flight
+  dev.waitForFences(1, &fences[currentFrame], VK_FALSE, UINT64_MAX);
+
+  // the frame that last used this slot, and every frame before it, has finished
+  if (frameCount >= framesInFlight)
+  {
+    completedFrames = frameCount - framesInFlight + 1;
+  }
+  TS_VmaReclaimStagingRing();
+  TS_VkCollectGarbage();
+
+  // hand out the pixels of finished frames before this slot's readback buffer is written again
+  TS_VkPollReadbacks();
+
+  // each frame in flight has an offscreen image of its own
+  if (headless)
+  {
+    frameIndex = currentFrame;
+  }
+  else
+  {
+    // some platforms never report eErrorOutOfDateKHR on resize, so compare sizes as well
+    int width = 0, height = 0;
+    SDL_Vulkan_GetDrawableSize(win, &width, &height);
+    if (uint32_t(width) != swapchainDrawableSize.width || uint32_t(height) != swapchainDrawableSize.height) swapchainOutOfDate = true;
+    if (swapchainOutOfDate && !TS_VkRecreateSwapchain()) return false;
+
+    vk::Result result = dev.acquireNextImageKHR(swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], vk::Fence(), &frameIndex);
+    if (result == vk::Result::eErrorOutOfDateKHR)
+    {
+      if (!TS_VkRecreateSwapchain()) return false;
+      result = dev.acquireNextImageKHR(swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], vk::Fence(), &frameIndex);
+    }
+    if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR) return false;
+
+    // still presentable, recreate after this frame
+    if (result == vk::Result::eSuboptimalKHR) swapchainOutOfDate = true;
+  }
+
+  // an older frame may still be rendering to the image we just acquired
+  if (imagesInFlight[frameIndex] && imagesInFlight[frameIndex] != fences[currentFrame])
+  {
+    dev.waitForFences(1, &imagesInFlight[frameIndex], VK_FALSE, UINT64_MAX);
+  }
+  imagesInFlight[frameIndex] = fences[currentFrame];
+
+  dev.resetFences(1, &fences[currentFrame]);
+  return true;
 }
 
 void TS_VkResetCommandBuffer()
 {
-  cmdbufs[frameIndex].reset();
+  cmdbufs[currentFrame].reset();
 }
 
 void TS_VkBeginCommandBuffer()
 {
-  cmdbufs[frameIndex].begin({vk::CommandBufferUsageFlagBits::eSimultaneousUse});
+  cmdbufs[currentFrame].begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
 }
 
-void TS_VkDraw(float r, float g, float b, float a)
+size_t TS_VertexSize()
+{
+  switch (vertexFormat)
+  {
+    case TS_VERTEX_FORMAT_COMPACT: return sizeof(TS_CompactVertex);
+    case TS_VERTEX_FORMAT_COMPACT_HALF_UV: return sizeof(TS_HalfUvVertex);
+    default: return sizeof(TS_Vertex);
+  }
+}
+
+void TS_VmaWriteVertexStream(TS_StreamBuffer &stream)
 {
-  // copy data
-  memcpy(al.getAllocationInfo(vertexStaging.second).pMappedData, (void*)vertices.data(), vertices.size() * sizeof(TS_Vertex));
-  memcpy(al.getAllocationInfo(indexStaging.second).pMappedData, (void*)indices.data(), indices.size() * sizeof(uint32_t));
+  vk::DeviceSize size = vertices.size() * TS_VertexSize();
+
+  if (vertexFormat == TS_VERTEX_FORMAT_FLOAT)
+  {
+    TS_VmaWriteStreamBuffer(stream, vertices.data(), size);
+    return;
+  }
+
+  // pack straight into the mapped staging buffer, there is no intermediate copy
+  void * dst = TS_VmaMapStreamBuffer(stream, size);
+  if (vertexFormat == TS_VERTEX_FORMAT_COMPACT)
+  {
+    TS_CompactVertex * out = (TS_CompactVertex*)dst;
+    for (const TS_Vertex &v : vertices)
+    {
+      out->pos = v.pos;
+      out->uv = v.uv;
+      out->col[0] = TS_PackUnorm8(v.col.r);
+      out->col[1] = TS_PackUnorm8(v.col.g);
+      out->col[2] = TS_PackUnorm8(v.col.b);
+      out->col[3] = TS_PackUnorm8(v.col.a);
+      out->tex = int16_t(v.tex);
+      out->depth = TS_PackUnorm16(v.depth);
+      ++out;
+    }
+  }
+  else
+  {
+    TS_HalfUvVertex * out = (TS_HalfUvVertex*)dst;
+    for (const TS_Vertex &v : vertices)
+    {
+      out->pos = v.pos;
+      out->uv = glm::packHalf2x16(v.uv);
+      out->col[0] = TS_PackUnorm8(v.col.r);
+      out->col[1] = TS_PackUnorm8(v.col.g);
+      out->col[2] = TS_PackUnorm8(v.col.b);
+      out->col[3] = TS_PackUnorm8(v.col.a);
+      out->tex = int16_t(v.tex);
+      out->depth = TS_PackUnorm16(v.depth);
+      ++out;
+    }
+  }
+}
+
+void TS_VkCmdReserveQuadIndices(vk::CommandBuffer &cmdbuf, uint32_t quads)
+{
+  if (quads <= quadIndexCapacity) return;
+
+  uint32_t capacity = std::max(quadIndexCapacity, defaultQuadIndexCapacity);
+  while (capacity < quads)
+  {
+    capacity *= 2;
+  }
+  vk::DeviceSize size = vk::DeviceSize(capacity) * 6 * sizeof(uint32_t);
+
+  vk::Buffer stagingBuf;
+  vk::DeviceSize stagingOffset;
+  uint32_t * dst = (uint32_t*)TS_VmaStageUpload(size, stagingBuf, stagingOffset);
+  for (uint32_t q = 0; q < capacity; ++q)
+  {
+    uint32_t v = q * 4;
+    dst[q * 6 + 0] = v;
+    dst[q * 6 + 1] = v + 1;
+    dst[q * 6 + 2] = v + 2;
+    dst[q * 6 + 3] = v + 2;
+    dst[q * 6 + 4] = v + 3;
+    dst[q * 6 + 5] = v;
+  }
+
+  // earlier frames may still be reading the outgrown buffer
+  if (quadIndexCapacity > 0)
+  {
+    std::pair<vk::Buffer, vma::Allocation> old = quadIndexBuffer;
+    TS_VkDeferDestroy([old]() { al.destroyBuffer(old.first, old.second); });
+  }
+
+  quadIndexBuffer = TS_VmaCreateBuffer(size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal);
+  quadIndexCapacity = capacity;
 
-  // copy buffers
   vk::BufferCopy bfcpy;
-  bfcpy.srcOffset = 0;
+  bfcpy.srcOffset = stagingOffset;
   bfcpy.dstOffset = 0;
-  bfcpy.size = defaultBufferSize;
-  cmdbufs[frameIndex].copyBuffer(vertexStaging.first, vertexBuffer.first, 1, &bfcpy);
-  cmdbufs[frameIndex].copyBuffer(indexStaging.first, indexBuffer.first, 1, &bfcpy);
+  bfcpy.size = size;
+  cmdbuf.copyBuffer(stagingBuf, quadIndexBuffer.first, 1, &bfcpy);
+
+  vk::BufferMemoryBarrier barrier;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eIndexRead;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = quadIndexBuffer.first;
+  barrier.offset = 0;
+  barrier.size = size;
+  cmdbuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(), 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void TS_VkDraw(float r, float g, float b, float a)
+{
+  TS_StreamBuffer &vertexStream = vertexStreams[currentFrame];
+  TS_StreamBuffer &indexStream = indexStreams[currentFrame];
+  TS_StreamBuffer &instanceStream = instanceStreams[currentFrame];
+
+  // upload static batches that changed, before they are culled and sorted with the rest of the frame
+  TS_VkCmdFlushStaticBatches(cmdbufs[currentFrame]);
+
+  // sort the quads recorded this frame and write them out as vertices or instances
+  TS_VkBuildDrawBatches();
+
+  vk::DeviceSize vertexBytes = vertices.size() * TS_VertexSize();
+  vk::DeviceSize indexBytes = indices.size() * sizeof(uint32_t);
+  vk::DeviceSize instanceBytes = instances.size() * sizeof(TS_Instance);
+
+  streamStats.vertexBytes = vertexBytes;
+  streamStats.indexBytes = indexBytes;
+  streamStats.instanceBytes = instanceBytes;
+  streamStats.vertexHighWater = std::max<uint64_t>(streamStats.vertexHighWater, vertexBytes);
+  streamStats.indexHighWater = std::max<uint64_t>(streamStats.indexHighWater, indexBytes);
+  streamStats.instanceHighWater = std::max<uint64_t>(streamStats.instanceHighWater, instanceBytes);
+  streamStats.culledQuads = culledQuads;
+
+  // record texture uploads queued since the last frame, and the tiles changed during this one
+  TS_VkQueueTilemapUploads();
+  TS_VkCmdFlushUploads(cmdbufs[currentFrame]);
+  TS_VkCmdAcquireTransfers(cmdbufs[currentFrame]);
+
+  // make sure the static quad indices cover every quad of this frame
+  uint32_t quadCount = static_cast<uint32_t>(vertices.size() / 4);
+  if (!triangleFans)
+  {
+    TS_VkCmdReserveQuadIndices(cmdbufs[currentFrame], quadCount);
+  }
 
-  // bind descriptor sets (sampler and textures)
-  cmdbufs[frameIndex].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, trianglePipelineLayout, 0, 1, &dscSet, 0, 0);
+  // the staging memory used so far is free again once this frame has finished
+  stagingRing.marks.push_back(std::make_pair(frameCount, stagingRing.head));
 
-  // bind vertex buffer
-  vk::Buffer vertexBuffers[] = {vertexBuffer.first};
-  vk::DeviceSize offsets[] = {0};
-  cmdbufs[frameIndex].bindVertexBuffers(0, 1, vertexBuffers, offsets);
+  // copy data, only the bytes used this frame
+  TS_VmaWriteVertexStream(vertexStream);
+  TS_VmaWriteStreamBuffer(indexStream, indices.data(), indexBytes);
+  TS_VmaWriteStreamBuffer(instanceStream, instances.data(), instanceBytes);
 
-  // bind index buffer
-  cmdbufs[frameIndex].bindIndexBuffer(indexBuffer.first, 0, vk::IndexType::eUint32);
+  // copy buffers
+  TS_VkCmdFlushStreamBuffer(cmdbufs[currentFrame], vertexStream, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+  TS_VkCmdFlushStreamBuffer(cmdbufs[currentFrame], indexStream, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+  TS_VkCmdFlushStreamBuffer(cmdbufs[currentFrame], instanceStream, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
 
-  // bind triangle pipeline
-  cmdbufs[frameIndex].bindPipeline(vk::PipelineBindPoint::eGraphics, trianglePipeline);
+  // bind descriptor sets (sampler and textures), this frame's set is not in use by the gpu so it may be rewritten
+  if (dscSetsDirty[currentFrame])
+  {
+    TS_VkWriteDescriptorSet(currentFrame);
+  }
+  cmdbufs[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, trianglePipelineLayout, 0, 1, &dscSets[currentFrame], 0, 0);
 
   // begin render pass
   vk::RenderPassBeginInfo rpi {
@@ -822,32 +3675,195 @@ void TS_VkDraw(float r, float g, float b, float a)
   rpi.clearValueCount = static_cast<uint32_t>(clearValues.size());
   rpi.pClearValues = clearValues.data();
 
-  cmdbufs[frameIndex].beginRenderPass(rpi, vk::SubpassContents::eInline);
+  cmdbufs[currentFrame].beginRenderPass(rpi, vk::SubpassContents::eInline);
+
+  // the pipelines outlive swapchain recreation, so the viewport is dynamic
+  vk::Viewport viewport(0.0f, 0.0f, (float) swapchainSize.width, (float) swapchainSize.height, 0.0f, 1.0f);
+  vk::Rect2D scissor(vk::Offset2D(), swapchainSize);
+  cmdbufs[currentFrame].setViewport(0, 1, &viewport);
+  cmdbufs[currentFrame].setScissor(0, 1, &scissor);
+
+  vk::DeviceSize offsets[] = {0};
+
+  // fans use four indices and a restart index per quad
+  if (!vertices.empty())
+  {
+    if (triangleFans)
+      cmdbufs[currentFrame].bindIndexBuffer(indexStream.buffer.first, 0, vk::IndexType::eUint32);
+    else
+      cmdbufs[currentFrame].bindIndexBuffer(quadIndexBuffer.first, 0, vk::IndexType::eUint32);
+  }
+  uint32_t indicesPerQuad = triangleFans ? 5 : 6;
+
+  // batches are in key order, opaque front to back so covered pixels fail the depth test before
+  // they are shaded, then blended back to front tested against depth but not writing it.
+  // pipelines and buffers are only bound when they change between batches
+  vk::Pipeline boundPipeline;
+  int boundPath = -1;
+  TS_PushConstants noOffset = {glm::vec2(0.0f), 0.0f};
+  for (const TS_DrawBatch &batch : drawBatches)
+  {
+    // the next range of painter's order starts with the depth buffer cleared
+    if (batch.clearDepth)
+    {
+      vk::ClearAttachment clear;
+      clear.aspectMask = vk::ImageAspectFlagBits::eDepth;
+      clear.clearValue = vk::ClearDepthStencilValue(1.0f, 0);
+      vk::ClearRect rect(vk::Rect2D(vk::Offset2D(), swapchainSize), 0, 1);
+      cmdbufs[currentFrame].clearAttachments(1, &clear, 1, &rect);
+      continue;
+    }
+
+    // tilemaps are one quad generated from the push constants
+    if (batch.tilemap)
+    {
+      vk::Pipeline pipeline = TS_VkGetTilemapPipeline(batch.blend);
+      if (pipeline != boundPipeline)
+      {
+        cmdbufs[currentFrame].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        boundPipeline = pipeline;
+      }
+
+      cmdbufs[currentFrame].pushConstants(trianglePipelineLayout, pushConstantStages, 0, sizeof(TS_TilemapPushConstants), &tilemapDraws[batch.first]);
+      cmdbufs[currentFrame].draw(4, 1, 0, 0);
+      boundPath = -1;
+      continue;
+    }
+
+    // static batches bind their own buffer and offset, streamed quads after them rebind and reset both
+    if (batch.staticBatch >= 0)
+    {
+      vk::Pipeline pipeline = TS_VkGetStaticBatchPipeline(batch.blend);
+      if (pipeline != boundPipeline)
+      {
+        cmdbufs[currentFrame].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        boundPipeline = pipeline;
+      }
+
+      TS_PushConstants constants = {batch.offset, batch.depth};
+      cmdbufs[currentFrame].pushConstants(trianglePipelineLayout, pushConstantStages, 0, sizeof(TS_PushConstants), &constants);
+      cmdbufs[currentFrame].bindVertexBuffers(0, 1, &staticBatchesById[batch.staticBatch].buffer.first, offsets);
+      cmdbufs[currentFrame].draw(4, batch.count, 0, 0);
+      boundPath = -1;
+      continue;
+    }
+
+    if (boundPath == -1)
+    {
+      cmdbufs[currentFrame].pushConstants(trianglePipelineLayout, pushConstantStages, 0, sizeof(TS_PushConstants), &noOffset);
+    }
+
+    if (int(batch.instanced) != boundPath)
+    {
+      vk::Buffer buffer = batch.instanced ? instanceStream.buffer.first : vertexStream.buffer.first;
+      cmdbufs[currentFrame].bindVertexBuffers(0, 1, &buffer, offsets);
+      boundPath = int(batch.instanced);
+    }
+
+    vk::Pipeline pipeline = TS_VkGetDrawPipeline(batch.instanced, batch.blend);
+    if (pipeline != boundPipeline)
+    {
+      cmdbufs[currentFrame].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+      boundPipeline = pipeline;
+    }
 
-  // draw indexed
-  cmdbufs[frameIndex].drawIndexed(static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    // instanced quads are four strip vertices without an index buffer
+    if (batch.instanced)
+      cmdbufs[currentFrame].draw(4, batch.count, 0, batch.first);
+    else
+      cmdbufs[currentFrame].drawIndexed(batch.count * indicesPerQuad, 1, batch.first * indicesPerQuad, 0, 0);
+  }
 
   // end render pass
-  cmdbufs[frameIndex].endRenderPass();
+  cmdbufs[currentFrame].endRenderPass();
+
+  // copy the frame back if it was asked for
+  TS_VkCmdCopyReadbacks(cmdbufs[currentFrame]);
 }
 
 void TS_VkEndCommandBuffer()
 {
-  cmdbufs[frameIndex].end();
+  cmdbufs[currentFrame].end();
 }
 
 void TS_VkQueueSubmit()
 {
-  vk::PipelineStageFlags waitDestStageMask = vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTransfer);
-  vk::SubmitInfo submitInfo(1, &imageAvailableSemaphore, &waitDestStageMask, 1, &cmdbufs[frameIndex], 1, &renderingFinishedSemaphore);
-  gq.submit(1, &submitInfo, fences[frameIndex]);
+  std::vector<vk::Semaphore> waitSemaphores;
+  std::vector<vk::PipelineStageFlags> waitStages;
+
+  // offscreen images are not acquired or presented
+  if (!headless)
+  {
+    waitSemaphores.push_back(imageAvailableSemaphores[currentFrame]);
+    waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer);
+  }
+
+  // uploads start on the transfer queue right away, while earlier frames are still rendering.
+  // the frame's fence covers them too, since it only signals after the frame waited for them
+  if (transferRecording)
+  {
+    transferCmdbufs[currentFrame].end();
+    vk::SubmitInfo transferInfo(0, nullptr, nullptr, 1, &transferCmdbufs[currentFrame], 1, &transferFinishedSemaphores[currentFrame]);
+    tq.submit(1, &transferInfo, vk::Fence());
+    transferRecording = false;
+
+    waitSemaphores.push_back(transferFinishedSemaphores[currentFrame]);
+    waitStages.push_back(vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eFragmentShader);
+  }
+
+  vk::SubmitInfo submitInfo(static_cast<uint32_t>(waitSemaphores.size()), waitSemaphores.data(), waitStages.data(),
+                            1, &cmdbufs[currentFrame],
+                            headless ? 0 : 1, &renderingFinishedSemaphores[currentFrame]);
+  gq.submit(1, &submitInfo, fences[currentFrame]);
+  ++frameCount;
 }
 
 void TS_VkQueuePresent()
 {
-  vk::PresentInfoKHR pInfo(1, &renderingFinishedSemaphore, 1, &swapchain, &frameIndex);
-  pq.presentKHR(pInfo);
-  pq.waitIdle();
+  if (!headless)
+  {
+    vk::PresentInfoKHR pInfo(1, &renderingFinishedSemaphores[currentFrame], 1, &swapchain, &frameIndex);
+    vk::Result result = pq.presentKHR(&pInfo);
+    if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) swapchainOutOfDate = true;
+  }
+
+  // no need to wait, the next frame only blocks once it reuses this frame's resources
+  currentFrame = (currentFrame + 1) % framesInFlight;
+}
+
+void TS_VkSetFramesInFlight(int n)
+{
+  // the per-frame resources are sized on init, so the count can't change underneath them
+  requestedFramesInFlight = CLAMP(n, 1, TS_MAX_FRAMES_IN_FLIGHT);
+}
+
+void TS_VkSetVertexFormat(TS_VertexFormat format)
+{
+  if (format < TS_VERTEX_FORMAT_FLOAT || format > TS_VERTEX_FORMAT_COMPACT_HALF_UV) format = TS_VERTEX_FORMAT_FLOAT;
+  // the pipelines are built for one layout, including the ones recreated on shader reload
+  requestedVertexFormat = format;
+}
+
+void TS_VkSetTriangleFans(bool enabled)
+{
+  // the topology is baked into the pipelines, so the index layout may only change with them
+  requestedTriangleFans = enabled;
+}
+
+void TS_VkSetInstancedDrawing(bool enabled)
+{
+  instancedDrawing = enabled;
+}
+
+void TS_VkSetBlendMode(TS_BlendMode mode)
+{
+  if (mode < 0 || mode >= TS_BLEND_MODE_COUNT) mode = TS_BLEND_MODE_ALPHA;
+  blendMode = mode;
+}
+
+void TS_VkSetLayer(int layer)
+{
+  drawLayer = CLAMP(layer, TS_MIN_LAYER, TS_MAX_LAYER);
 }
 
 void TS_VkPopulateDebugMessengerCreateInfo(vk::DebugUtilsMessengerCreateInfoEXT& dbmci)
@@ -864,12 +3880,22 @@ void TS_VkPopulateDebugMessengerCreateInfo(vk::DebugUtilsMessengerCreateInfoEXT&
 
 void TS_VkCreateInstance()
 {
-  VULKAN_HPP_DEFAULT_DISPATCHER.init((PFN_vkGetInstanceProcAddr)SDL_Vulkan_GetVkGetInstanceProcAddr());
+  // without a window SDL has not loaded the vulkan library, and no surface extensions are needed
+  std::vector<const char *> extensionNames;
+  if (headless)
+  {
+    vulkanLoader = new vk::DynamicLoader();
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(vulkanLoader->getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr"));
+  }
+  else
+  {
+    VULKAN_HPP_DEFAULT_DISPATCHER.init((PFN_vkGetInstanceProcAddr)SDL_Vulkan_GetVkGetInstanceProcAddr());
 
-  unsigned int extensionCount = 0;
-  SDL_Vulkan_GetInstanceExtensions(win, &extensionCount, nullptr);
-  std::vector<const char *> extensionNames(extensionCount);
-  SDL_Vulkan_GetInstanceExtensions(win, &extensionCount, extensionNames.data());
+    unsigned int extensionCount = 0;
+    SDL_Vulkan_GetInstanceExtensions(win, &extensionCount, nullptr);
+    extensionNames.resize(extensionCount);
+    SDL_Vulkan_GetInstanceExtensions(win, &extensionCount, extensionNames.data());
+  }
 
   vk::ApplicationInfo appInfo {
     window_name,
@@ -919,12 +3945,187 @@ void TS_VkCreateDebugMessenger()
 
 void TS_VkCreateSurface()
 {
+  if (headless) return;
   SDL_Vulkan_CreateSurface(win, inst, &srf);
 }
 
+std::string TS_VkFormatUUID(const uint8_t * uuid)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string str;
+  for (int i = 0; i < VK_UUID_SIZE; ++i)
+  {
+    if (i == 4 || i == 6 || i == 8 || i == 10) str += '-';
+    str += digits[uuid[i] >> 4];
+    str += digits[uuid[i] & 15];
+  }
+  return str;
+}
+
+std::string TS_VkGetDeviceUUID(vk::PhysicalDevice device)
+{
+  auto props = device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+  return TS_VkFormatUUID(props.get<vk::PhysicalDeviceIDProperties>().deviceUUID.data());
+}
+
+bool TS_VkMatchesRequestedDevice(vk::PhysicalDevice device, const std::string &requested)
+{
+  // dashes and case are ignored in uuids, names match on any case-insensitive substring
+  auto normalize = [](const std::string &str, bool stripDashes) {
+    std::string out;
+    for (char c : str)
+    {
+      if (stripDashes && c == '-') continue;
+      out += char(std::tolower((unsigned char)c));
+    }
+    return out;
+  };
+
+  if (normalize(TS_VkGetDeviceUUID(device), true) == normalize(requested, true)) return true;
+  return normalize(device.getProperties().deviceName.data(), false).find(normalize(requested, false)) != std::string::npos;
+}
+
+bool TS_VkIsDeviceSuitable(vk::PhysicalDevice device, std::string &reason)
+{
+  vk::PhysicalDeviceProperties props = device.getProperties();
+  if (props.apiVersion < VK_API_VERSION_1_2)
+  {
+    reason = "Vulkan 1.2 is not supported";
+    return false;
+  }
+
+  std::vector<const char*> requiredExtensions = {VK_EXT_ROBUSTNESS_2_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
+  if (!headless)
+  {
+    requiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+  std::vector<vk::ExtensionProperties> extensions = device.enumerateDeviceExtensionProperties();
+  for (const char * name : requiredExtensions)
+  {
+    bool found = std::any_of(extensions.begin(), extensions.end(), [name](const vk::ExtensionProperties &ext) {
+      return strcmp(ext.extensionName.data(), name) == 0;
+    });
+    if (!found)
+    {
+      reason = std::string(name) + " is not supported";
+      return false;
+    }
+  }
+
+  // everything TS_VkCreateDevice enables
+  auto features = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceRobustness2FeaturesEXT>();
+  const vk::PhysicalDeviceFeatures &core = features.get<vk::PhysicalDeviceFeatures2>().features;
+  const vk::PhysicalDeviceVulkan12Features &vulkan12 = features.get<vk::PhysicalDeviceVulkan12Features>();
+  if (!core.samplerAnisotropy || !core.shaderSampledImageArrayDynamicIndexing || !vulkan12.descriptorIndexing ||
+      !vulkan12.descriptorBindingPartiallyBound || !features.get<vk::PhysicalDeviceRobustness2FeaturesEXT>().nullDescriptor)
+  {
+    reason = "descriptor indexing or null descriptors are not supported";
+    return false;
+  }
+
+  bool graphics = false;
+  bool present = headless;
+  std::vector<vk::QueueFamilyProperties> queueFamilies = device.getQueueFamilyProperties();
+  for (uint32_t i = 0; i < queueFamilies.size(); ++i)
+  {
+    if (queueFamilies[i].queueCount == 0) continue;
+    graphics |= bool(queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics);
+    present |= !headless && device.getSurfaceSupportKHR(i, srf);
+  }
+  if (!graphics || !present)
+  {
+    reason = "no queue can draw or present";
+    return false;
+  }
+  return true;
+}
+
+uint64_t TS_VkScoreDevice(vk::PhysicalDevice device)
+{
+  // the device type decides, the amount of device local memory breaks ties
+  uint64_t typeScore = 0;
+  switch (device.getProperties().deviceType)
+  {
+    case vk::PhysicalDeviceType::eDiscreteGpu: typeScore = 4; break;
+    case vk::PhysicalDeviceType::eIntegratedGpu: typeScore = 3; break;
+    case vk::PhysicalDeviceType::eVirtualGpu: typeScore = 2; break;
+    case vk::PhysicalDeviceType::eCpu: typeScore = 1; break;
+    default: break;
+  }
+
+  vk::DeviceSize localMemory = 0;
+  vk::PhysicalDeviceMemoryProperties memory = device.getMemoryProperties();
+  for (uint32_t i = 0; i < memory.memoryHeapCount; ++i)
+  {
+    if (memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) localMemory += memory.memoryHeaps[i].size;
+  }
+
+  return (typeScore << 48) + std::min<vk::DeviceSize>(localMemory >> 20, (uint64_t(1) << 48) - 1);
+}
+
 void TS_VkSelectPhysicalDevice()
 {
-  pdev = inst.enumeratePhysicalDevices()[0]; // TODO improve selection
+  std::vector<vk::PhysicalDevice> devices = inst.enumeratePhysicalDevices();
+
+  // the environment takes precedence, so benchmarks can pin a device without rebuilding
+  const char * env = std::getenv("TELESCOPE_DEVICE");
+  std::string requested = (env != nullptr && env[0] != '\0') ? std::string(env) : requestedDevice;
+
+  pdev = vk::PhysicalDevice();
+  std::string reason;
+  if (!requested.empty())
+  {
+    for (vk::PhysicalDevice device : devices)
+    {
+      if (!TS_VkMatchesRequestedDevice(device, requested)) continue;
+      if (TS_VkIsDeviceSuitable(device, reason))
+      {
+        pdev = device;
+        break;
+      }
+      std::cerr << "Vulkan device " << device.getProperties().deviceName.data() << " cannot be used: " << reason << std::endl;
+    }
+    if (!pdev)
+    {
+      std::cerr << "No usable Vulkan device matches " << requested << ", selecting one automatically" << std::endl;
+    }
+  }
+
+  if (!pdev)
+  {
+    uint64_t bestScore = 0;
+    for (vk::PhysicalDevice device : devices)
+    {
+      if (!TS_VkIsDeviceSuitable(device, reason)) continue;
+      uint64_t score = TS_VkScoreDevice(device);
+      if (!pdev || score > bestScore)
+      {
+        pdev = device;
+        bestScore = score;
+      }
+    }
+  }
+
+  if (!pdev)
+  {
+    throw std::runtime_error("No Vulkan device supports the features Telescope needs");
+  }
+
+  vk::PhysicalDeviceProperties props = pdev.getProperties();
+  selectedDeviceName = props.deviceName.data();
+  std::cerr << "Telescope is using " << selectedDeviceName << " (" << vk::to_string(props.deviceType) << ", uuid "
+            << TS_VkGetDeviceUUID(pdev) << ", Vulkan " << VK_VERSION_MAJOR(props.apiVersion) << "." << VK_VERSION_MINOR(props.apiVersion)
+            << "." << VK_VERSION_PATCH(props.apiVersion) << ")" << std::endl;
+}
+
+void TS_VkSetPhysicalDevice(const char * name_or_uuid)
+{
+  requestedDevice = name_or_uuid != nullptr ? name_or_uuid : "";
+}
+
+const char * TS_VkGetPhysicalDeviceName()
+{
+  return selectedDeviceName.c_str();
 }
 
 void TS_VkSelectQueueFamily()
@@ -935,18 +4136,45 @@ void TS_VkSelectQueueFamily()
   for (const auto& qf : pdev.getQueueFamilyProperties())
   {
     if (qf.queueCount > 0 && qf.queueFlags & vk::QueueFlagBits::eGraphics) graphicIndex = i;
-    bool presentSupport = pdev.getSurfaceSupportKHR(i, srf);
+    bool presentSupport = !headless && pdev.getSurfaceSupportKHR(i, srf);
     if (qf.queueCount > 0 && presentSupport) presentIndex = i;
-    if (graphicIndex != -1 && presentIndex != -1) break;
+    if (graphicIndex != -1 && (presentIndex != -1 || headless)) break;
     ++i;
   }
   graphicsQueueFamilyIndex = graphicIndex;
-  presentQueueFamilyIndex = presentIndex;
+
+  // nothing is presented when headless, the present queue is the graphics queue
+  presentQueueFamilyIndex = headless ? graphicIndex : presentIndex;
+
+  // a family that can only transfer is usually a separate dma engine, one that can also compute is the next best.
+  // texture regions are copied at any offset, so the family must not restrict the granularity of image copies
+  transferQueueFamilyIndex = graphicsQueueFamilyIndex;
+  int bestRank = 0;
+  i = 0;
+  for (const auto& qf : pdev.getQueueFamilyProperties())
+  {
+    vk::Extent3D granularity = qf.minImageTransferGranularity;
+    bool transferOnly = qf.queueCount > 0 && qf.queueFlags & vk::QueueFlagBits::eTransfer && !(qf.queueFlags & vk::QueueFlagBits::eGraphics);
+    if (transferOnly && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+    {
+      int rank = (qf.queueFlags & vk::QueueFlagBits::eCompute) ? 1 : 2;
+      if (rank > bestRank)
+      {
+        transferQueueFamilyIndex = i;
+        bestRank = rank;
+      }
+    }
+    ++i;
+  }
 }
 
 void TS_VkCreateDevice()
 {
-  const std::vector<const char*> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_EXT_ROBUSTNESS_2_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
+  std::vector<const char*> deviceExtensions = {VK_EXT_ROBUSTNESS_2_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
+  if (!headless)
+  {
+    deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
   const float queue_priority[] = { 1.0f };
   float queuePriority = queue_priority[0];
 
@@ -966,11 +4194,22 @@ void TS_VkCreateDevice()
     &queuePriority
   };
 
+  vk::DeviceQueueCreateInfo tr {
+    vk::DeviceQueueCreateFlags(),
+    transferQueueFamilyIndex,
+    1,
+    &queuePriority
+  };
+
   queueCreateInfos.push_back(gr);
   if (graphicsQueueFamilyIndex != presentQueueFamilyIndex)
   {
     queueCreateInfos.push_back(pr);
   }
+  if (transferQueueFamilyIndex != graphicsQueueFamilyIndex && transferQueueFamilyIndex != presentQueueFamilyIndex)
+  {
+    queueCreateInfos.push_back(tr);
+  }
 
   vk::PhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
@@ -999,6 +4238,7 @@ void TS_VkCreateDevice()
   VULKAN_HPP_DEFAULT_DISPATCHER.init(dev);
   gq = dev.getQueue(graphicsQueueFamilyIndex, 0);
   pq = dev.getQueue(presentQueueFamilyIndex, 0);
+  tq = dev.getQueue(transferQueueFamilyIndex, 0);
 }
 
 void TS_VmaCreateAllocator()
@@ -1020,29 +4260,85 @@ void TS_VmaCreateAllocator()
 
 void TS_VmaCreateBuffers()
 {
-  vertexStaging = TS_VmaCreateBuffer(defaultBufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                                    vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible,
-                                    vma::AllocationCreateFlagBits::eMapped);
-  indexStaging = TS_VmaCreateBuffer(defaultBufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-                                    vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible,
-                                    vma::AllocationCreateFlagBits::eMapped);
-  vertexBuffer = TS_VmaCreateBuffer(defaultBufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-                                    vk::MemoryPropertyFlagBits::eDeviceLocal);
-  indexBuffer = TS_VmaCreateBuffer(defaultBufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-                                    vk::MemoryPropertyFlagBits::eDeviceLocal);
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    vertexStreams.push_back(TS_VmaCreateStreamBuffer(vk::BufferUsageFlagBits::eVertexBuffer));
+    indexStreams.push_back(TS_VmaCreateStreamBuffer(vk::BufferUsageFlagBits::eIndexBuffer));
+    instanceStreams.push_back(TS_VmaCreateStreamBuffer(vk::BufferUsageFlagBits::eVertexBuffer));
+  }
+
+  TS_VmaCreateStagingRing(defaultStagingSize);
 }
 
-void TS_VkCreateSwapchain()
+vk::SurfaceFormatKHR TS_VkSelectSurfaceFormat()
 {
-  surfaceCapabilities = pdev.getSurfaceCapabilitiesKHR(srf);
   std::vector<vk::SurfaceFormatKHR> surfaceFormats = pdev.getSurfaceFormatsKHR(srf);
-  surfaceFormat = surfaceFormats[0];
-  int width,height = 0;
+
+  // a single undefined format leaves the choice to us
+  vk::SurfaceFormatKHR preferred(vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear);
+  if (surfaceFormats.size() == 1 && surfaceFormats[0].format == vk::Format::eUndefined) return preferred;
+
+  // colors are written as given, so prefer unorm formats over srgb ones
+  for (vk::Format fmt : {vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm})
+  {
+    for (const vk::SurfaceFormatKHR &f : surfaceFormats)
+    {
+      if (f.format == fmt && f.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) return f;
+    }
+  }
+  return surfaceFormats[0];
+}
+
+vk::PresentModeKHR TS_VkSelectPresentMode()
+{
+  std::vector<vk::PresentModeKHR> presentModes = pdev.getSurfacePresentModesKHR(srf);
+
+  // modes without vsync stand in for each other, fifo is the only mode every device supports
+  std::vector<vk::PresentModeKHR> candidates;
+  switch (requestedPresentMode)
+  {
+    case TS_PRESENT_MODE_MAILBOX:
+      candidates = {vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate};
+      break;
+    case TS_PRESENT_MODE_IMMEDIATE:
+      candidates = {vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox};
+      break;
+    case TS_PRESENT_MODE_FIFO_RELAXED:
+      candidates = {vk::PresentModeKHR::eFifoRelaxed};
+      break;
+    default:
+      break;
+  }
+
+  for (vk::PresentModeKHR mode : candidates)
+  {
+    if (std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end()) return mode;
+  }
+  return vk::PresentModeKHR::eFifo;
+}
+
+void TS_VkCreateSwapchain(vk::SwapchainKHR oldSwapchain = vk::SwapchainKHR())
+{
+  surfaceCapabilities = pdev.getSurfaceCapabilitiesKHR(srf);
+  surfaceFormat = TS_VkSelectSurfaceFormat();
+  presentMode = TS_VkSelectPresentMode();
+
+  int width = 0, height = 0;
   SDL_Vulkan_GetDrawableSize(win, &width, &height);
-  width = CLAMP(width, surfaceCapabilities.minImageExtent.width, surfaceCapabilities.maxImageExtent.width);
-  height = CLAMP(height, surfaceCapabilities.minImageExtent.height, surfaceCapabilities.maxImageExtent.height);
-  swapchainSize.width = width;
-  swapchainSize.height = height;
+  swapchainDrawableSize = vk::Extent2D(width, height);
+
+  // the surface either dictates its size or takes the size of the drawable
+  if (surfaceCapabilities.currentExtent.width != UINT32_MAX)
+  {
+    swapchainSize = surfaceCapabilities.currentExtent;
+  }
+  else
+  {
+    swapchainSize.width = CLAMP(uint32_t(width), surfaceCapabilities.minImageExtent.width, surfaceCapabilities.maxImageExtent.width);
+    swapchainSize.height = CLAMP(uint32_t(height), surfaceCapabilities.minImageExtent.height, surfaceCapabilities.maxImageExtent.height);
+  }
+
+  // one image more than the minimum, so mailbox always has an image to render to while one is queued
   uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
   if (surfaceCapabilities.maxImageCount > 0 && imageCount > surfaceCapabilities.maxImageCount)
   {
@@ -1051,12 +4347,19 @@ void TS_VkCreateSwapchain()
 
   vk::SwapchainCreateInfoKHR createInfo;
   createInfo.surface = srf;
-  createInfo.minImageCount = surfaceCapabilities.minImageCount;
+  createInfo.minImageCount = imageCount;
   createInfo.imageFormat = surfaceFormat.format;
   createInfo.imageColorSpace = surfaceFormat.colorSpace;
   createInfo.imageExtent = swapchainSize;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+
+  // frames can only be read back if the images may be copied from
+  swapchainReadable = bool(surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc);
+  if (swapchainReadable)
+  {
+    createInfo.imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+  }
   uint32_t queueFamilyIndices[] = {graphicsQueueFamilyIndex, presentQueueFamilyIndex};
   if (graphicsQueueFamilyIndex != presentQueueFamilyIndex)
   {
@@ -1070,13 +4373,33 @@ void TS_VkCreateSwapchain()
   }
   createInfo.preTransform = surfaceCapabilities.currentTransform;
   createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
-  createInfo.presentMode = vk::PresentModeKHR::eFifo;
+  createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = oldSwapchain;
   swapchain = dev.createSwapchainKHR(createInfo);
+  swapchainOutOfDate = false;
   swapchainImages = dev.getSwapchainImagesKHR(swapchain);
   swapchainImageCount = static_cast<uint32_t>(swapchainImages.size());
 }
 
+void TS_VkCreateOffscreenImages()
+{
+  // stand-ins for the swapchain, rendered to one per frame in flight
+  surfaceFormat.format = vk::Format::eR8G8B8A8Unorm;
+  surfaceFormat.colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+  swapchainSize.width = window_width;
+  swapchainSize.height = window_height;
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    offscreenImages.push_back(TS_VmaCreateImage(window_width, window_height, surfaceFormat.format, vk::ImageTiling::eOptimal,
+                                                vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+                                                vk::MemoryPropertyFlagBits::eDeviceLocal));
+    swapchainImages.push_back(offscreenImages.back().first);
+  }
+  swapchainImageCount = static_cast<uint32_t>(swapchainImages.size());
+  swapchainReadable = true;
+}
+
 void TS_VkCreateImageViews()
 {
   for (int i = 0; i < swapchainImages.size(); ++i)
@@ -1089,16 +4412,20 @@ void TS_VkSetupDepthStencil()
 {
   TS_VkGetSupportedDepthFormat();
   depthImage = TS_VmaCreateImage(swapchainSize.width, swapchainSize.height,
-                  vk::Format::eD32SfloatS8Uint, vk::ImageTiling::eOptimal,
+                  depthFormat, vk::ImageTiling::eOptimal,
                   vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-  depthImageView = TS_VkCreateImageView(depthImage.first, vk::Format::eD32SfloatS8Uint, vk::ImageAspectFlagBits::eDepth);
+  // attachment views of combined formats cover both aspects
+  vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eDepth;
+  if (depthFormat != vk::Format::eD32Sfloat && depthFormat != vk::Format::eD16Unorm)
+    aspect |= vk::ImageAspectFlagBits::eStencil;
+
+  depthImageView = TS_VkCreateImageView(depthImage.first, depthFormat, aspect);
 }
 
 void TS_VkCreateRenderPass()
 {
-  std::vector<vk::AttachmentDescription> attachments(1);
-  // std::vector<vk::AttachmentDescription> attachments(2);
+  std::vector<vk::AttachmentDescription> attachments(2);
 
   attachments[0].format = surfaceFormat.format;
   attachments[0].samples = vk::SampleCountFlagBits::e1;
@@ -1107,79 +4434,219 @@ void TS_VkCreateRenderPass()
   attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
   attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
   attachments[0].initialLayout = vk::ImageLayout::eUndefined;
-  attachments[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
-
-  // attachments[1].format = depthFormat;
-  // attachments[1].samples = vk::SampleCountFlagBits::e1;
-  // attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
-  // attachments[1].storeOp = vk::AttachmentStoreOp::eStore;
-  // attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eClear;
-  // attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-  // attachments[1].initialLayout = vk::ImageLayout::eUndefined;
-  // attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  attachments[0].finalLayout = headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+  // depth only lives for the duration of the pass
+  attachments[1].format = depthFormat;
+  attachments[1].samples = vk::SampleCountFlagBits::e1;
+  attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
+  attachments[1].storeOp = vk::AttachmentStoreOp::eDontCare;
+  attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+  attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+  attachments[1].initialLayout = vk::ImageLayout::eUndefined;
+  attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
   vk::AttachmentReference colorReference {
     0, vk::ImageLayout::eColorAttachmentOptimal
   };
 
-  // vk::AttachmentReference depthReference {
-  //   1, vk::ImageLayout::eDepthStencilAttachmentOptimal
-  // };
+  vk::AttachmentReference depthReference {
+    1, vk::ImageLayout::eDepthStencilAttachmentOptimal
+  };
 
   vk::SubpassDescription subpassDescription;
   subpassDescription.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
   subpassDescription.colorAttachmentCount = 1;
   subpassDescription.pColorAttachments = &colorReference;
-  // subpassDescription.pDepthStencilAttachment = &depthReference;
+  subpassDescription.pDepthStencilAttachment = &depthReference;
   subpassDescription.inputAttachmentCount = 0;
   subpassDescription.pInputAttachments = nullptr;
   subpassDescription.preserveAttachmentCount = 0;
   subpassDescription.pPreserveAttachments = nullptr;
   subpassDescription.pResolveAttachments = nullptr;
 
-  std::vector<vk::SubpassDependency> dependencies(1);
+  std::vector<vk::SubpassDependency> dependencies(3);
+
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
+  dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  dependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;
+  dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentRead;
+  dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+
+  // all frames in flight share the depth image, the clear waits for the previous frame's depth writes
+  dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].dstSubpass = 0;
+  dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+  dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+  dependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+  dependencies[1].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+  dependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+
+  // readbacks copy the color attachment after the pass, the copy must wait for the transition to the final layout
+  dependencies[2].srcSubpass = 0;
+  dependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[2].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  dependencies[2].dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+  dependencies[2].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+  dependencies[2].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+  vk::RenderPassCreateInfo renderPassInfo;
+  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpassDescription;
+  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+  renderPassInfo.pDependencies = dependencies.data();
+
+  rp = dev.createRenderPass(renderPassInfo);
+}
+
+bool TS_CompileShader(const std::string &code, shaderc_shader_kind kind, const char * name, bool optimize, std::vector<uint32_t> &spirv, std::string &error)
+{
+  shaderc::Compiler compiler;
+  shaderc::CompileOptions options;
+
+  if (optimize) options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+  shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(
+                                code, kind, name, options);
+
+  if (module.GetCompilationStatus() != shaderc_compilation_status_success) {
+    error = module.GetErrorMessage();
+    return false;
+  }
+
+  spirv.assign(module.cbegin(), module.cend());
+  return true;
+}
+
+vk::ShaderModule TS_VkCreateShaderModuleFromSpirv(const uint32_t * code, size_t size)
+{
+  vk::ShaderModuleCreateInfo createInfo;
+  createInfo.codeSize = size;
+  createInfo.pCode = code;
+
+  return dev.createShaderModule(createInfo);
+}
+
+vk::ShaderModule TS_VkCreateShaderModule(std::string code, shaderc_shader_kind kind, bool optimize)
+{
+  std::vector<uint32_t> spv;
+  std::string error;
+  if (!TS_CompileShader(code, kind, "shader_src", optimize, spv, error))
+  {
+    std::cerr << error;
+    return nullptr;
+  }
+
+  return TS_VkCreateShaderModuleFromSpirv(spv.data(), spv.size() * sizeof(uint32_t));
+}
+
+vk::ShaderModule TS_VkCreateEmbeddedShaderModule(const uint32_t * spirv, size_t size, const char * glsl, shaderc_shader_kind kind)
+{
+  // precompiled at build time, shaderc is only needed if glslc was not available
+  if (spirv != nullptr)
+  {
+    return TS_VkCreateShaderModuleFromSpirv(spirv, size);
+  }
+  return TS_VkCreateShaderModule(std::string(glsl), kind, true);
+}
+
+uint64_t TS_HashShader(const std::string &code, shaderc_shader_kind kind)
+{
+  // 64-bit fnv-1a over the source, followed by the stage
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : code)
+  {
+    hash ^= uint8_t(c);
+    hash *= 1099511628211ull;
+  }
+  hash ^= uint64_t(kind);
+  hash *= 1099511628211ull;
+  return hash;
+}
 
-  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependencies[0].dstSubpass = 0;
-  dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
-  dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-  dependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;
-  dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentRead;
-  dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+void TS_PollShaderSources()
+{
+  for (int i = 0; i < TS_SHADER_COUNT; ++i)
+  {
+    TS_ShaderSource &src = shaderSources[i];
 
-  vk::RenderPassCreateInfo renderPassInfo;
-  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-  renderPassInfo.pAttachments = attachments.data();
-  renderPassInfo.subpassCount = 1;
-  renderPassInfo.pSubpasses = &subpassDescription;
-  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
-  renderPassInfo.pDependencies = dependencies.data();
+    // a missing file keeps the shader in use
+    std::ifstream file(shaderReloadDir + "/" + src.fname, std::ios::binary);
+    if (!file) continue;
+    std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-  rp = dev.createRenderPass(renderPassInfo);
+    uint64_t hash = TS_HashShader(code, src.kind);
+    if (hash == src.hash) continue;
+    src.hash = hash;
+
+    auto cached = spirvCache.find(hash);
+    if (cached == spirvCache.end())
+    {
+      std::vector<uint32_t> spirv;
+      std::string error;
+      if (!TS_CompileShader(code, src.kind, src.fname, true, spirv, error))
+      {
+        // keep drawing with the last version that compiled, the file is compiled again once it changes
+        std::cerr << error;
+        continue;
+      }
+      cached = spirvCache.emplace(hash, std::move(spirv)).first;
+    }
+
+    std::lock_guard<std::mutex> lock(shaderWatchMutex);
+    reloadedSpirv[i] = cached->second;
+    shaderReloadPending = true;
+  }
 }
 
-vk::ShaderModule TS_VkCreateShaderModule(std::string code, shaderc_shader_kind kind, bool optimize)
+void TS_ShaderWatcher()
 {
-  shaderc::Compiler compiler;
-  shaderc::CompileOptions options;
-
-  if (optimize) options.SetOptimizationLevel(shaderc_optimization_level_performance);
+  std::unique_lock<std::mutex> lock(shaderWatchMutex);
+  while (!shaderWatchQuit)
+  {
+    lock.unlock();
+    TS_PollShaderSources();
+    lock.lock();
+    shaderWatchCv.wait_for(lock, std::chrono::milliseconds(TS_SHADER_WATCH_INTERVAL_MS), []() { return shaderWatchQuit; });
+  }
+}
 
-  shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(
-                                code, kind, "shader_src", options);
+void TS_VkStartShaderWatcher()
+{
+  if (shaderReloadDir.empty() || shaderWatcher.joinable()) return;
 
-  if (module.GetCompilationStatus() != shaderc_compilation_status_success) {
-    std::cerr << module.GetErrorMessage();
-    return nullptr;
+  // files matching the embedded sources do not trigger a reload
+  for (TS_ShaderSource &src : shaderSources)
+  {
+    if (src.hash == 0) src.hash = TS_HashShader(src.glsl, src.kind);
   }
 
-  std::vector<uint32_t> spv = {module.cbegin(), module.cend()};
+  shaderWatchQuit = false;
+  shaderWatcher = std::thread(TS_ShaderWatcher);
+}
 
-  vk::ShaderModuleCreateInfo createInfo;
-  createInfo.codeSize = spv.size() * sizeof(uint32_t);
-  createInfo.pCode = reinterpret_cast<const uint32_t*>(spv.data());
+void TS_VkStopShaderWatcher()
+{
+  if (!shaderWatcher.joinable()) return;
 
-  return dev.createShaderModule(createInfo);
+  {
+    std::lock_guard<std::mutex> lock(shaderWatchMutex);
+    shaderWatchQuit = true;
+  }
+  shaderWatchCv.notify_all();
+  shaderWatcher.join();
+  shaderWatchQuit = false;
+}
+
+void TS_VkSetShaderHotReload(const char * shaderDir)
+{
+  TS_VkStopShaderWatcher();
+  shaderReloadDir = (shaderDir != nullptr) ? shaderDir : "";
+  TS_VkStartShaderWatcher();
 }
 
 void TS_VkCreateDescriptorSet()
@@ -1219,15 +4686,22 @@ void TS_VkCreateDescriptorSet()
   txtsBinding.binding = 1;
   txtsBinding.descriptorCount = NUM_SUPPORTED_TEXTURES;
 
-  vk::DescriptorSetLayoutBinding layoutBindings[] = {smpBinding, txtsBinding};
+  vk::DescriptorSetLayoutBinding tilemapsBinding;
+  tilemapsBinding.descriptorType = vk::DescriptorType::eSampledImage;
+  tilemapsBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  tilemapsBinding.binding = 2;
+  tilemapsBinding.descriptorCount = TS_MAX_TILEMAPS;
+
+  vk::DescriptorSetLayoutBinding layoutBindings[] = {smpBinding, txtsBinding, tilemapsBinding};
 
   vk::DescriptorSetLayoutCreateInfo layoutInfo;
-  layoutInfo.bindingCount = 2;
+  layoutInfo.bindingCount = 3;
   layoutInfo.pBindings = layoutBindings;
 
-  vk::DescriptorBindingFlags layoutBindingFlags[] = {vk::DescriptorBindingFlags(), vk::DescriptorBindingFlagBits::ePartiallyBound};
+  // free tilemap slots are never written, only the slots of existing tilemaps are read
+  vk::DescriptorBindingFlags layoutBindingFlags[] = {vk::DescriptorBindingFlags(), vk::DescriptorBindingFlagBits::ePartiallyBound, vk::DescriptorBindingFlagBits::ePartiallyBound};
   vk::DescriptorSetLayoutBindingFlagsCreateInfo layoutFlagsInfo;
-  layoutFlagsInfo.bindingCount = 2;
+  layoutFlagsInfo.bindingCount = 3;
   layoutFlagsInfo.pBindingFlags = layoutBindingFlags;
   layoutInfo.pNext = &layoutFlagsInfo;
 
@@ -1235,71 +4709,108 @@ void TS_VkCreateDescriptorSet()
 
   vk::DescriptorPoolSize smpPoolSize;
   smpPoolSize.type = vk::DescriptorType::eSampler;
-  smpPoolSize.descriptorCount = 1;
+  smpPoolSize.descriptorCount = framesInFlight;
   vk::DescriptorPoolSize txtsPoolSize;
   txtsPoolSize.type = vk::DescriptorType::eSampledImage;
-  txtsPoolSize.descriptorCount = NUM_SUPPORTED_TEXTURES;
+  txtsPoolSize.descriptorCount = (NUM_SUPPORTED_TEXTURES + TS_MAX_TILEMAPS) * framesInFlight;
   std::array<vk::DescriptorPoolSize, 2> poolSizes = {smpPoolSize, txtsPoolSize};
 
   vk::DescriptorPoolCreateInfo poolCreateInfo;
   poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
   poolCreateInfo.pPoolSizes = poolSizes.data();
-  poolCreateInfo.maxSets = 1 + NUM_SUPPORTED_TEXTURES;
+  poolCreateInfo.maxSets = framesInFlight;
   poolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
   dscPool = dev.createDescriptorPool(poolCreateInfo);
 
+  std::vector<vk::DescriptorSetLayout> layouts(framesInFlight, dscSetLayout);
   vk::DescriptorSetAllocateInfo allocInfo;
   allocInfo.descriptorPool = dscPool;
-  allocInfo.descriptorSetCount = 1;
-  allocInfo.pSetLayouts = &dscSetLayout;
-  dscSet = dev.allocateDescriptorSets(allocInfo)[0];
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = layouts.data();
+  dscSets = dev.allocateDescriptorSets(allocInfo);
 }
 
-void TS_VkCreateTrianglePipeline()
+TS_PipelineCacheHeader TS_VkGetPipelineCacheHeader()
 {
-  std::string vertShaderCode = R"""(
-    #version 450
+  vk::PhysicalDeviceProperties props = pdev.getProperties();
+
+  TS_PipelineCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TS_PIPELINE_CACHE_MAGIC;
+  header.version = TS_PIPELINE_CACHE_VERSION;
+  header.vendorID = props.vendorID;
+  header.deviceID = props.deviceID;
+  header.driverVersion = props.driverVersion;
+  memcpy(header.uuid, props.pipelineCacheUUID.data(), VK_UUID_SIZE);
+
+  return header;
+}
 
-    layout(location = 0) in vec2 inPos;
-    layout(location = 1) in vec2 inUv;
-    layout(location = 2) in vec4 inCol;
-    layout(location = 3) in int inTex;
+void TS_VkCreatePipelineCache()
+{
+  char * prefPath = SDL_GetPrefPath("Telescope", "pipeline_cache");
+  if (prefPath != NULL)
+  {
+    pipelineCachePath = std::string(prefPath) + "pipeline_cache.bin";
+    SDL_free(prefPath);
+  }
 
-    layout(location = 0) out vec4 fragCol;
-    layout(location = 1) out int fragTex;
-    layout(location = 2) out vec2 fragUv;
+  std::vector<char> data;
+  std::ifstream file(pipelineCachePath, std::ios::binary);
+  if (!pipelineCachePath.empty() && file)
+  {
+    // a cache written by another device or driver is ignored, drivers are not required to reject it themselves
+    TS_PipelineCacheHeader expected = TS_VkGetPipelineCacheHeader();
+    TS_PipelineCacheHeader header;
+    if (file.read((char*)&header, sizeof(header)) &&
+        header.magic == expected.magic && header.version == expected.version &&
+        header.vendorID == expected.vendorID && header.deviceID == expected.deviceID &&
+        header.driverVersion == expected.driverVersion &&
+        memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) == 0)
+    {
+      // a corrupted size must not allocate more than the file can hold
+      std::streampos dataStart = file.tellg();
+      file.seekg(0, std::ios::end);
+      std::streamoff remaining = file.tellg() - dataStart;
+      file.seekg(dataStart);
 
-    void main() {
-        gl_Position = vec4(inPos, 0.0, 1.0);
-        fragCol = inCol;
-        fragTex = inTex;
-        fragUv = inUv;
+      if (remaining >= 0 && header.dataSize == uint64_t(remaining))
+      {
+        data.resize(header.dataSize);
+        if (!file.read(data.data(), data.size())) data.clear();
+      }
     }
-  )""";
-
-  std::string fragShaderCode = R"""(
-    #version 450
-
-    layout(set = 0, binding = 0) uniform sampler smp;
-    layout(set = 0, binding = 1) uniform texture2D txts[80];
+  }
 
-    layout(location = 0) in vec4 fragCol;
-    layout(location = 1) flat in int fragTex;
-    layout(location = 2) in vec2 fragUv;
+  vk::PipelineCacheCreateInfo cacheInfo;
+  cacheInfo.initialDataSize = data.size();
+  cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+  pipelineCache = dev.createPipelineCache(cacheInfo);
+}
 
-    layout(location = 0) out vec4 outCol;
+void TS_VkSavePipelineCache()
+{
+  if (pipelineCachePath.empty()) return;
 
-    void main() {
-        if (fragTex == -1)
-            outCol = fragCol;
-        else
-            outCol = fragCol * texture(sampler2D(txts[fragTex], smp), fragUv);
-    }
-  )""";
+  std::vector<uint8_t> data = dev.getPipelineCacheData(pipelineCache);
+  TS_PipelineCacheHeader header = TS_VkGetPipelineCacheHeader();
+  header.dataSize = data.size();
 
-  vk::ShaderModule vertShaderModule = TS_VkCreateShaderModule(vertShaderCode, shaderc_glsl_vertex_shader, true);
-  vk::ShaderModule fragShaderModule = TS_VkCreateShaderModule(fragShaderCode, shaderc_glsl_fragment_shader, true);
+  // write to a temporary file first, so a crash never leaves a truncated cache behind
+  std::string tmpPath = pipelineCachePath + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file) return;
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)data.data(), data.size());
+    if (!file) return;
+  }
+  std::remove(pipelineCachePath.c_str());
+  std::rename(tmpPath.c_str(), pipelineCachePath.c_str());
+}
 
+vk::Pipeline TS_VkCreateQuadPipeline(vk::ShaderModule vertShaderModule, vk::ShaderModule fragShaderModule, const vk::PipelineVertexInputStateCreateInfo &vertexInputInfo, vk::PrimitiveTopology topology, bool primitiveRestart, TS_BlendMode blend, vk::CompareOp depthCompare)
+{
   vk::PipelineShaderStageCreateInfo vertShaderStageInfo;
   vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
   vertShaderStageInfo.module = vertShaderModule;
@@ -1312,35 +4823,19 @@ void TS_VkCreateTrianglePipeline()
 
   vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-  vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-  auto bindingDescription = TS_Vertex::getBindingDescription();
-  auto attributeDescriptions = TS_Vertex::getAttributeDescriptions();
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
   vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
-  inputAssembly.topology = vk::PrimitiveTopology::eTriangleFan;
-  inputAssembly.primitiveRestartEnable = true;
-
-  vk::Viewport viewport;
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float) swapchainSize.width;
-  viewport.height = (float) swapchainSize.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  vk::Rect2D scissor;
-  scissor.offset = vk::Offset2D();
-  scissor.extent = swapchainSize;
+  inputAssembly.topology = topology;
+  inputAssembly.primitiveRestartEnable = primitiveRestart;
 
+  // set when drawing, see TS_VkDraw
   vk::PipelineViewportStateCreateInfo viewportState;
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
+
+  vk::DynamicState dynamicStates[] = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dynamicState;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
 
   vk::PipelineRasterizationStateCreateInfo rasterizer;
   rasterizer.depthClampEnable = false;
@@ -1355,15 +4850,43 @@ void TS_VkCreateTrianglePipeline()
   multisampling.sampleShadingEnable = false;
   multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
 
+  // every quad has a depth of its own, see TS_VkBuildDrawBatches.
+  // blended quads are tested against opaque ones but do not hide what is drawn behind them
+  vk::PipelineDepthStencilStateCreateInfo depthStencil;
+  depthStencil.depthTestEnable = true;
+  depthStencil.depthWriteEnable = (blend == TS_BLEND_MODE_OPAQUE);
+  depthStencil.depthCompareOp = depthCompare;
+
   vk::PipelineColorBlendAttachmentState colorBlendAttachment;
   colorBlendAttachment.blendEnable = true;
   colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-  colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
-  colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
   colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
-  colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eSrcAlpha;
-  colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
   colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+  switch (blend)
+  {
+    case TS_BLEND_MODE_OPAQUE:
+      // the framebuffer is never read
+      colorBlendAttachment.blendEnable = false;
+      break;
+    case TS_BLEND_MODE_ADDITIVE:
+      colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+      colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOne;
+      colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eZero;
+      colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+      break;
+    case TS_BLEND_MODE_PREMULTIPLIED:
+      colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eOne;
+      colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+      colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+      colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+      break;
+    default:
+      colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+      colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+      colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eSrcAlpha;
+      colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+      break;
+  }
 
   vk::PipelineColorBlendStateCreateInfo colorBlending;
   colorBlending.logicOpEnable = false;
@@ -1375,13 +4898,6 @@ void TS_VkCreateTrianglePipeline()
   colorBlending.blendConstants[2] = 0.0f;
   colorBlending.blendConstants[3] = 0.0f;
 
-  vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &dscSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-  trianglePipelineLayout = dev.createPipelineLayout(pipelineLayoutInfo);
-
   vk::GraphicsPipelineCreateInfo pipelineInfo;
   pipelineInfo.stageCount = 2;
   pipelineInfo.pStages = shaderStages;
@@ -1391,14 +4907,184 @@ void TS_VkCreateTrianglePipeline()
   pipelineInfo.pRasterizationState = &rasterizer;
   pipelineInfo.pMultisampleState = &multisampling;
   pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDepthStencilState = &depthStencil;
+  pipelineInfo.pDynamicState = &dynamicState;
   pipelineInfo.layout = trianglePipelineLayout;
   pipelineInfo.renderPass = rp;
   pipelineInfo.subpass = 0;
 
-  trianglePipeline = dev.createGraphicsPipeline(vk::PipelineCache(), pipelineInfo).value;
+  return dev.createGraphicsPipeline(pipelineCache, pipelineInfo).value;
+}
+
+void TS_VkCreateShaderModules()
+{
+  // shaders reloaded from disk take precedence over the embedded ones
+  std::vector<uint32_t> spirv[TS_SHADER_COUNT];
+  {
+    std::lock_guard<std::mutex> lock(shaderWatchMutex);
+    for (int i = 0; i < TS_SHADER_COUNT; ++i)
+    {
+      spirv[i] = reloadedSpirv[i];
+    }
+    shaderReloadPending = false;
+  }
+
+  for (int i = 0; i < TS_SHADER_COUNT; ++i)
+  {
+    const TS_ShaderSource &src = shaderSources[i];
+    if (!spirv[i].empty())
+      shaderModules[i] = TS_VkCreateShaderModuleFromSpirv(spirv[i].data(), spirv[i].size() * sizeof(uint32_t));
+    else
+      shaderModules[i] = TS_VkCreateEmbeddedShaderModule(src.spirv, src.spirvSize, src.glsl, src.kind);
+  }
+}
+
+void TS_VkDestroyShaderModules()
+{
+  for (vk::ShaderModule &module : shaderModules)
+  {
+    dev.destroy(module);
+    module = nullptr;
+  }
+}
+
+vk::Pipeline TS_VkCreateDrawPipeline(bool instanced, TS_BlendMode blend, vk::CompareOp depthCompare)
+{
+  vk::ShaderModule fragShaderModule = shaderModules[TS_SHADER_QUAD_FRAG];
+
+  if (instanced)
+  {
+    vk::PipelineVertexInputStateCreateInfo instanceInputInfo;
+    auto instanceBindingDescription = TS_Instance::getBindingDescription();
+    auto instanceAttributeDescriptions = TS_Instance::getAttributeDescriptions();
+    instanceInputInfo.vertexBindingDescriptionCount = 1;
+    instanceInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(instanceAttributeDescriptions.size());
+    instanceInputInfo.pVertexBindingDescriptions = &instanceBindingDescription;
+    instanceInputInfo.pVertexAttributeDescriptions = instanceAttributeDescriptions.data();
+
+    return TS_VkCreateQuadPipeline(shaderModules[TS_SHADER_QUAD_INSTANCED_VERT], fragShaderModule, instanceInputInfo, vk::PrimitiveTopology::eTriangleStrip, false, blend, depthCompare);
+  }
+
+  vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+  vk::VertexInputBindingDescription bindingDescription;
+  std::array<vk::VertexInputAttributeDescription, 5> attributeDescriptions;
+  switch (vertexFormat)
+  {
+    case TS_VERTEX_FORMAT_COMPACT:
+      bindingDescription = TS_CompactVertex::getBindingDescription();
+      attributeDescriptions = TS_CompactVertex::getAttributeDescriptions();
+      break;
+    case TS_VERTEX_FORMAT_COMPACT_HALF_UV:
+      bindingDescription = TS_HalfUvVertex::getBindingDescription();
+      attributeDescriptions = TS_HalfUvVertex::getAttributeDescriptions();
+      break;
+    default:
+      bindingDescription = TS_Vertex::getBindingDescription();
+      attributeDescriptions = TS_Vertex::getAttributeDescriptions();
+      break;
+  }
+  vertexInputInfo.vertexBindingDescriptionCount = 1;
+  vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+  if (triangleFans)
+    return TS_VkCreateQuadPipeline(shaderModules[TS_SHADER_QUAD_VERT], fragShaderModule, vertexInputInfo, vk::PrimitiveTopology::eTriangleFan, true, blend, depthCompare);
+  else
+    return TS_VkCreateQuadPipeline(shaderModules[TS_SHADER_QUAD_VERT], fragShaderModule, vertexInputInfo, vk::PrimitiveTopology::eTriangleList, false, blend, depthCompare);
+}
+
+vk::CompareOp TS_DepthCompareOp(TS_BlendMode blend)
+{
+  // opaque quads are drawn front to back, on equal depth the one drawn first must win.
+  // blended quads are drawn in painter's order and may be level with the opaque quad below them
+  return blend == TS_BLEND_MODE_OPAQUE ? vk::CompareOp::eLess : vk::CompareOp::eLessOrEqual;
+}
+
+vk::Pipeline TS_VkGetDrawPipeline(bool instanced, TS_BlendMode blend)
+{
+  vk::Pipeline &pipeline = instanced ? instancedPipelines[blend] : trianglePipelines[blend];
+  if (!pipeline) pipeline = TS_VkCreateDrawPipeline(instanced, blend, TS_DepthCompareOp(blend));
+  return pipeline;
+}
+
+vk::Pipeline TS_VkGetStaticBatchPipeline(TS_BlendMode blend)
+{
+  // quads within a static batch share a depth and are drawn in the order they were added,
+  // so opaque batches need a variant that passes on equal depth
+  if (blend != TS_BLEND_MODE_OPAQUE) return TS_VkGetDrawPipeline(true, blend);
+
+  if (!opaqueStaticBatchPipeline) opaqueStaticBatchPipeline = TS_VkCreateDrawPipeline(true, blend, vk::CompareOp::eLessOrEqual);
+  return opaqueStaticBatchPipeline;
+}
+
+vk::Pipeline TS_VkGetTilemapPipeline(TS_BlendMode blend)
+{
+  // the quad is generated from gl_VertexIndex, there is no vertex input
+  vk::Pipeline &pipeline = tilemapPipelines[blend];
+  if (!pipeline)
+  {
+    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+    pipeline = TS_VkCreateQuadPipeline(shaderModules[TS_SHADER_TILEMAP_VERT], shaderModules[TS_SHADER_TILEMAP_FRAG], vertexInputInfo, vk::PrimitiveTopology::eTriangleStrip, false, blend, TS_DepthCompareOp(blend));
+  }
+  return pipeline;
+}
+
+void TS_VkCreateTrianglePipeline()
+{
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &dscSetLayout;
+
+  // static batches are drawn at an offset and depth of their own, tilemaps pass all their parameters
+  vk::PushConstantRange pushConstantRange;
+  pushConstantRange.stageFlags = pushConstantStages;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = static_cast<uint32_t>(std::max(sizeof(TS_PushConstants), sizeof(TS_TilemapPushConstants)));
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  trianglePipelineLayout = dev.createPipelineLayout(pipelineLayoutInfo);
+
+  TS_VkCreateShaderModules();
+
+  // the default blend mode is created up front, other variants on first use
+  TS_VkGetDrawPipeline(false, TS_BLEND_MODE_ALPHA);
+  TS_VkGetDrawPipeline(true, TS_BLEND_MODE_ALPHA);
+}
+
+void TS_VkApplyShaderReload()
+{
+  {
+    std::lock_guard<std::mutex> lock(shaderWatchMutex);
+    if (!shaderReloadPending) return;
+  }
+
+  // frames still in flight keep drawing with the old pipelines, the layout is unchanged
+  std::vector<vk::Pipeline> oldPipelines;
+  for (int i = 0; i < TS_BLEND_MODE_COUNT; ++i)
+  {
+    if (trianglePipelines[i]) oldPipelines.push_back(trianglePipelines[i]);
+    if (instancedPipelines[i]) oldPipelines.push_back(instancedPipelines[i]);
+    if (tilemapPipelines[i]) oldPipelines.push_back(tilemapPipelines[i]);
+    trianglePipelines[i] = nullptr;
+    instancedPipelines[i] = nullptr;
+    tilemapPipelines[i] = nullptr;
+  }
+  if (opaqueStaticBatchPipeline) oldPipelines.push_back(opaqueStaticBatchPipeline);
+  opaqueStaticBatchPipeline = nullptr;
+  TS_VkDeferDestroy([oldPipelines]() {
+    for (vk::Pipeline pipeline : oldPipelines)
+    {
+      dev.destroy(pipeline);
+    }
+  });
 
-  dev.destroyShaderModule(fragShaderModule);
-  dev.destroyShaderModule(vertShaderModule);
+  // pipelines never reference their modules once created
+  TS_VkDestroyShaderModules();
+  TS_VkCreateShaderModules();
+  TS_VkGetDrawPipeline(false, TS_BLEND_MODE_ALPHA);
+  TS_VkGetDrawPipeline(true, TS_BLEND_MODE_ALPHA);
 }
 
 void TS_VkCreateFramebuffers()
@@ -1407,7 +5093,7 @@ void TS_VkCreateFramebuffers()
   {
     std::vector<vk::ImageView> attachments {
       swapchainImageViews[i],
-      // depthImageView
+      depthImageView
     };
 
     vk::FramebufferCreateInfo framebufferInfo {
@@ -1425,49 +5111,78 @@ void TS_VkCreateCommandPool()
     vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient,
     graphicsQueueFamilyIndex
   });
+
+  if (TS_VkHasTransferQueue())
+  {
+    transferCp = dev.createCommandPool({
+      vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient,
+      transferQueueFamilyIndex
+    });
+  }
 }
 
 void TS_VkAllocateCommandBuffers()
 {
-  cmdbufs = dev.allocateCommandBuffers({cp, vk::CommandBufferLevel::ePrimary, swapchainImageCount});
+  cmdbufs = dev.allocateCommandBuffers({cp, vk::CommandBufferLevel::ePrimary, framesInFlight});
+
+  if (TS_VkHasTransferQueue())
+  {
+    transferCmdbufs = dev.allocateCommandBuffers({transferCp, vk::CommandBufferLevel::ePrimary, framesInFlight});
+  }
 }
 
 void TS_VkCreateSemaphores()
 {
-  imageAvailableSemaphore = dev.createSemaphore({});
-  renderingFinishedSemaphore = dev.createSemaphore({});
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    imageAvailableSemaphores.push_back(dev.createSemaphore({}));
+    renderingFinishedSemaphores.push_back(dev.createSemaphore({}));
+    if (TS_VkHasTransferQueue()) transferFinishedSemaphores.push_back(dev.createSemaphore({}));
+  }
 }
 
 void TS_VkCreateFences()
 {
-  for (uint32_t i = 0; i < swapchainImageCount; ++i)
+  for (uint32_t i = 0; i < framesInFlight; ++i)
   {
     fences.push_back(dev.createFence({vk::FenceCreateFlagBits::eSignaled}));
   }
+  imagesInFlight.assign(swapchainImageCount, vk::Fence());
+  currentFrame = 0;
 }
 
 void TS_VkInit()
 {
+  framesInFlight = requestedFramesInFlight;
+  vertexFormat = requestedVertexFormat;
+  triangleFans = requestedTriangleFans;
+
   TS_VkCreateInstance();
   TS_VkCreateDebugMessenger();
   TS_VkCreateSurface();
   TS_VkSelectPhysicalDevice();
   TS_VkSelectQueueFamily();
   TS_VkCreateDevice();
+  TS_VkCreatePipelineCache();
   TS_VmaCreateAllocator();
   TS_VmaCreateBuffers();
-  TS_VkCreateSwapchain();
+  if (headless)
+    TS_VkCreateOffscreenImages();
+  else
+    TS_VkCreateSwapchain();
   TS_VkCreateImageViews();
   TS_VkSetupDepthStencil();
   TS_VkCreateRenderPass();
   TS_VkCreateDescriptorSet();
-  TS_VkWriteDescriptorSet();
+  TS_VkInvalidateDescriptorSets();
   TS_VkCreateTrianglePipeline();
   TS_VkCreateFramebuffers();
   TS_VkCreateCommandPool();
   TS_VkAllocateCommandBuffers();
   TS_VkCreateSemaphores();
   TS_VkCreateFences();
+  TS_VkCreatePlaceholderTexture();
+  TS_VkStartShaderWatcher();
 }
 
 void TS_BtAddRigidBox(int id, float hx, float hy, float hz, float m, float px, float py, float pz, bool isKinematic)
@@ -1649,28 +5364,55 @@ void TS_BtInit()
 
 void TS_VkDestroyFences()
 {
-  for (int i = 0; i < swapchainImageCount; ++i)
+  for (vk::Fence f : fences)
   {
-    dev.destroyFence(fences[i]);
+    dev.destroyFence(f);
   }
   fences.clear();
+  imagesInFlight.clear();
 }
 
 void TS_VkDestroySemaphores()
 {
-  dev.destroySemaphore(imageAvailableSemaphore);
-  dev.destroySemaphore(renderingFinishedSemaphore);
+  for (uint32_t i = 0; i < imageAvailableSemaphores.size(); ++i)
+  {
+    dev.destroySemaphore(imageAvailableSemaphores[i]);
+    dev.destroySemaphore(renderingFinishedSemaphores[i]);
+  }
+  imageAvailableSemaphores.clear();
+  renderingFinishedSemaphores.clear();
+
+  for (vk::Semaphore sem : transferFinishedSemaphores)
+  {
+    dev.destroySemaphore(sem);
+  }
+  transferFinishedSemaphores.clear();
 }
 
 void TS_VkFreeCommandBuffers()
 {
   dev.freeCommandBuffers(cp, cmdbufs);
   cmdbufs.clear();
+
+  if (!transferCmdbufs.empty())
+  {
+    dev.freeCommandBuffers(transferCp, transferCmdbufs);
+    transferCmdbufs.clear();
+  }
+  transferRecording = false;
+  transferAcquireImageBarriers.clear();
+  transferAcquireBufferBarriers.clear();
 }
 
 void TS_VkDestroyCommandPool()
 {
   dev.destroyCommandPool(cp);
+
+  if (transferCp)
+  {
+    dev.destroyCommandPool(transferCp);
+    transferCp = vk::CommandPool();
+  }
 }
 
 void TS_VkDestroyFramebuffers()
@@ -1684,13 +5426,33 @@ void TS_VkDestroyFramebuffers()
 
 void TS_VkDestroyTrianglePipeline()
 {
-  dev.destroy(trianglePipeline);
+  for (int i = 0; i < TS_BLEND_MODE_COUNT; ++i)
+  {
+    dev.destroy(instancedPipelines[i]);
+    dev.destroy(trianglePipelines[i]);
+    dev.destroy(tilemapPipelines[i]);
+    instancedPipelines[i] = nullptr;
+    trianglePipelines[i] = nullptr;
+    tilemapPipelines[i] = nullptr;
+  }
+  dev.destroy(opaqueStaticBatchPipeline);
+  opaqueStaticBatchPipeline = nullptr;
+  TS_VkDestroyShaderModules();
   dev.destroy(trianglePipelineLayout);
 }
 
+void TS_VkDestroyPipelineCache()
+{
+  TS_VkSavePipelineCache();
+  dev.destroy(pipelineCache);
+  pipelineCachePath.clear();
+}
+
 void TS_VkDestroyDescriptorSet()
 {
-  dev.freeDescriptorSets(dscPool, 1, &dscSet);
+  dev.freeDescriptorSets(dscPool, dscSets);
+  dscSets.clear();
+  dscSetsDirty.clear();
   dev.destroy(dscSetLayout);
   dev.destroy(smp);
   dev.destroy(dscPool);
@@ -1719,26 +5481,114 @@ void TS_VkDestroyImageViews()
 void TS_VkDestroySwapchain()
 {
   dev.destroySwapchainKHR(swapchain);
+  swapchain = vk::SwapchainKHR();
+  swapchainImages.clear();
+}
+
+bool TS_VkRecreateSwapchain()
+{
+  // a minimized window has no size, frames are skipped until it is restored
+  int width = 0, height = 0;
+  SDL_Vulkan_GetDrawableSize(win, &width, &height);
+  vk::Extent2D currentExtent = pdev.getSurfaceCapabilitiesKHR(srf).currentExtent;
+  if (width == 0 || height == 0 || currentExtent.width == 0 || currentExtent.height == 0) return false;
+
+  // frames in flight still render to the old images
+  dev.waitIdle();
+  TS_VkDestroyFramebuffers();
+  TS_VkTeardownDepthStencil();
+  TS_VkDestroyImageViews();
+
+  vk::SwapchainKHR oldSwapchain = swapchain;
+  TS_VkCreateSwapchain(oldSwapchain);
+  dev.destroySwapchainKHR(oldSwapchain);
+
+  TS_VkCreateImageViews();
+  TS_VkSetupDepthStencil();
+  TS_VkCreateFramebuffers();
+  imagesInFlight.assign(swapchainImageCount, vk::Fence());
+
+  // positions are in window coordinates, static batches converted them to ndc ahead of time
+  SDL_GetWindowSize(win, &window_width, &window_height);
+  for (auto &entry : staticBatchesById)
+  {
+    entry.second.dirty = true;
+  }
+  return true;
+}
+
+void TS_VkSetPresentMode(TS_PresentMode mode)
+{
+  requestedPresentMode = mode;
+
+  // the swapchain is recreated with the new mode before the next frame
+  if (swapchain) swapchainOutOfDate = true;
+}
+
+TS_PresentMode TS_VkGetPresentMode()
+{
+  switch (presentMode)
+  {
+    case vk::PresentModeKHR::eMailbox: return TS_PRESENT_MODE_MAILBOX;
+    case vk::PresentModeKHR::eImmediate: return TS_PRESENT_MODE_IMMEDIATE;
+    case vk::PresentModeKHR::eFifoRelaxed: return TS_PRESENT_MODE_FIFO_RELAXED;
+    default: return TS_PRESENT_MODE_FIFO;
+  }
+}
+
+void TS_VkDestroyOffscreenImages()
+{
+  for (auto &img : offscreenImages)
+  {
+    al.destroyImage(img.first, img.second);
+  }
+  offscreenImages.clear();
+  swapchainImages.clear();
 }
 
 void TS_VmaDestroyBuffers()
 {
-  al.destroyBuffer(vertexStaging.first, vertexStaging.second);
-  al.destroyBuffer(indexStaging.first, indexStaging.second);
-  al.destroyBuffer(vertexBuffer.first, vertexBuffer.second);
-  al.destroyBuffer(indexBuffer.first, indexBuffer.second);
+  for (TS_StreamBuffer &stream : vertexStreams)
+  {
+    TS_VmaDestroyStreamBuffer(stream);
+  }
+  for (TS_StreamBuffer &stream : indexStreams)
+  {
+    TS_VmaDestroyStreamBuffer(stream);
+  }
+  for (TS_StreamBuffer &stream : instanceStreams)
+  {
+    TS_VmaDestroyStreamBuffer(stream);
+  }
+  vertexStreams.clear();
+  indexStreams.clear();
+  instanceStreams.clear();
+
+  if (quadIndexCapacity > 0)
+  {
+    al.destroyBuffer(quadIndexBuffer.first, quadIndexBuffer.second);
+    quadIndexCapacity = 0;
+  }
+
+  TS_VmaDestroyStagingRing();
 }
 
 void TS_VkDestroyTextures()
 {
-  for (std::map<std::string, int>::iterator it = txtInds.begin(); it != txtInds.end(); ++it)
+  for (int i = 0; i < NUM_SUPPORTED_TEXTURES; ++i)
   {
-    al.destroyImage(txts[it->second].img.first, txts[it->second].img.second);
-    dev.destroyImageView(txts[it->second].view);
-    availableInds.push(it->second);
+    if (!txts[i].view) continue;
+    al.destroyImage(txts[i].img.first, txts[i].img.second);
+    dev.destroyImageView(txts[i].view);
+    availableInds.push(i);
   }
 
-  txtInds.clear();
+  txtTable.clear();
+  txtTableCount = 0;
+  txtTableTombstones = 0;
+  txtRegions.clear();
+  availableRegions = std::queue<int>();
+  pendingUploads.clear();
   txts.fill(TS_Texture());
   dscImgInfos.fill(vk::DescriptorImageInfo());
 }
@@ -1757,6 +5607,7 @@ void TS_VkDestroyDevice()
 
 void TS_VkDestroySurface()
 {
+  if (headless) return;
   inst.destroySurfaceKHR(srf);
 }
 
@@ -1769,23 +5620,50 @@ void TS_VkDestroyDebugMessenger()
 void TS_VkDestroyInstance()
 {
   inst.destroy();
+
+  delete vulkanLoader;
+  vulkanLoader = nullptr;
 }
 
 void TS_VkQuit()
 {
+  TS_VkStopDecodeWorkers();
+  TS_VkStopShaderWatcher();
+
+  // frames may still be in flight
+  dev.waitIdle();
+  TS_VkDestroyStaticBatches();
+  TS_VkDestroyTilemaps();
+  completedFrames = UINT64_MAX;
+  TS_VkCollectGarbage();
+
+  // readbacks of submitted frames are complete now, ones of a frame never submitted are dropped
+  TS_VkPollReadbacks();
+  pendingReadbacks.clear();
+  TS_VmaDestroyReadbackBuffers();
+  capturePrefix.clear();
+  TS_VkStopEncodeWorker();
+  frameCount = 0;
+  completedFrames = 0;
+
   TS_VkDestroyFences();
   TS_VkDestroySemaphores();
   TS_VkFreeCommandBuffers();
   TS_VkDestroyCommandPool();
   TS_VkDestroyFramebuffers();
   TS_VkDestroyTrianglePipeline();
+  TS_VkDestroyPipelineCache();
   TS_VkDestroyDescriptorSet();
   TS_VkDestroyRenderPass();
   TS_VkTeardownDepthStencil();
   TS_VkDestroyImageViews();
-  TS_VkDestroySwapchain();
+  if (headless)
+    TS_VkDestroyOffscreenImages();
+  else
+    TS_VkDestroySwapchain();
   TS_VmaDestroyBuffers();
   TS_VkDestroyTextures();
+  TS_VkDestroyPlaceholderTexture();
   TS_VmaDestroyAllocator();
   TS_VkDestroyDevice();
   TS_VkDestroySurface();
@@ -1831,7 +5709,7 @@ void TS_Init(const char * ttl, int wdth, int hght)
   window_name = ttl;
   window_width = wdth;
   window_height = hght;
-  win = SDL_CreateWindow(ttl, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, wdth, hght, SDL_WINDOW_VULKAN|SDL_WINDOW_ALLOW_HIGHDPI|SDL_WINDOW_SHOWN);
+  win = SDL_CreateWindow(ttl, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, wdth, hght, SDL_WINDOW_VULKAN|SDL_WINDOW_ALLOW_HIGHDPI|SDL_WINDOW_SHOWN|SDL_WINDOW_RESIZABLE);
   if (win == NULL)
   {
     std::cerr << "Failed to create window: " << TS_SDLGetError() << std::endl;
@@ -1846,43 +5724,93 @@ void TS_Init(const char * ttl, int wdth, int hght)
   TS_BtInit();
 }
 
+void TS_InitHeadless(int wdth, int hght)
+{
+  // no window, so no video subsystem, and no audio
+  if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) != 0)
+  {
+    std::cerr << "Unable to initialize SDL: " << TS_SDLGetError() << std::endl;
+  }
+
+  int img_init_flags = IMG_INIT_JPG | IMG_INIT_PNG | IMG_INIT_TIF;
+  if ((IMG_Init(img_init_flags) & img_init_flags) != img_init_flags)
+  {
+    std::cerr << "Failed to initialize SDL_image, textures will not load" << std::endl;
+  }
+
+  headless = true;
+  window_name = "Telescope";
+  window_width = wdth;
+  window_height = hght;
+
+  TS_VkInit();
+
+  TS_BtInit();
+}
+
 void TS_Quit()
 {
   TS_VkQuit();
 
-  SDL_DestroyWindow(win);
+  while (!spatialHashesById.empty()) TS_SpatialHashDestroy(spatialHashesById.begin()->first);
+
+  // headless states have neither a window nor audio
+  if (!headless)
+  {
+    SDL_DestroyWindow(win);
+    win = NULL;
 
-  Mix_HaltMusic();
-  Mix_HaltChannel(-1);
-  Mix_CloseAudio();
+    Mix_HaltMusic();
+    Mix_HaltChannel(-1);
+    Mix_CloseAudio();
+    Mix_Quit();
+  }
 
   IMG_Quit();
-  Mix_Quit();
   SDL_Quit();
 
   TS_BtQuit();
+  headless = false;
 }
 
 void TS_VkBeginDrawPass()
 {
-  TS_VkAcquireNextImage();
-  TS_VkResetCommandBuffer();
-  TS_VkBeginCommandBuffer();
+  frameSkipped = !TS_VkAcquireNextImage();
+  if (!frameSkipped)
+  {
+    TS_VkResetCommandBuffer();
+    TS_VkBeginCommandBuffer();
+  }
+
+  // the fence for this frame has signaled, buffers outgrown by its last use can go
+  TS_VmaReleaseRetiredBuffers(vertexStreams[currentFrame]);
+  TS_VmaReleaseRetiredBuffers(indexStreams[currentFrame]);
+  TS_VmaReleaseRetiredBuffers(instanceStreams[currentFrame]);
 
-  // clear data
+  // hand textures decoded in the background to the upload queue
+  TS_VkProcessDecodedTextures();
+
+  // swap in shaders edited since the last frame, before anything is recorded with the pipelines
+  TS_VkApplyShaderReload();
+
+  // clear data, the buffers themselves are never cleared since only the bytes written are drawn
   vertices.clear();
   indices.clear();
   current_index = 0;
-
-  // clear buffers
-  memset(al.getAllocationInfo(vertexStaging.second).pMappedData, 0, defaultBufferSize);
-  memset(al.getAllocationInfo(indexStaging.second).pMappedData, 0, defaultBufferSize);
-  cmdbufs[frameIndex].fillBuffer(vertexBuffer.first, 0, VK_WHOLE_SIZE, 0);
-  cmdbufs[frameIndex].fillBuffer(indexBuffer.first, 0, VK_WHOLE_SIZE, 0);
+  instances.clear();
+  quadCommands.clear();
+  drawKeys.clear();
+  layerCounts.clear();
+  drawBatches.clear();
+  tilemapDraws.clear();
+  culledQuads = 0;
 }
 
 void TS_VkEndDrawPass(float r, float g, float b, float a)
 {
+  // the commands of this frame are dropped at the next TS_VkBeginDrawPass
+  if (frameSkipped) return;
+
   TS_VkDraw(r, g, b, a);
   TS_VkEndCommandBuffer();
   TS_VkQueueSubmit();
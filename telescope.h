@@ -14,11 +14,54 @@
 
 #include <include/physics_object.hpp>
 #include <include/collision_event.hpp>
+#include <include/render_stats.hpp>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/// \brief layout of the vertices uploaded each frame, see TS_VkSetVertexFormat
+typedef enum TS_VertexFormat {
+    /// \brief float position, float uv, float color, 32-bit texture index, float depth
+    TS_VERTEX_FORMAT_FLOAT = 0,
+
+    /// \brief 24 bytes: float position, float uv, unorm8 color, 16-bit texture index, unorm16 depth
+    TS_VERTEX_FORMAT_COMPACT = 1,
+
+    /// \brief 20 bytes: float position, half float uv, unorm8 color, 16-bit texture index, unorm16 depth
+    TS_VERTEX_FORMAT_COMPACT_HALF_UV = 2
+} TS_VertexFormat;
+
+/// \brief how quads are combined with what was drawn before them, see TS_VkSetBlendMode
+typedef enum TS_BlendMode {
+    /// \brief no blending, the quad replaces the framebuffer including its transparent texels
+    TS_BLEND_MODE_OPAQUE = 0,
+
+    /// \brief color * alpha + framebuffer * (1 - alpha)
+    TS_BLEND_MODE_ALPHA = 1,
+
+    /// \brief color * alpha + framebuffer, for particles and lights
+    TS_BLEND_MODE_ADDITIVE = 2,
+
+    /// \brief color + framebuffer * (1 - alpha), for textures with premultiplied alpha
+    TS_BLEND_MODE_PREMULTIPLIED = 3
+} TS_BlendMode;
+
+/// \brief how finished frames are handed to the display, see TS_VkSetPresentMode
+typedef enum TS_PresentMode {
+    /// \brief wait for vertical blank, never tears. Supported everywhere
+    TS_PRESENT_MODE_FIFO = 0,
+
+    /// \brief replace the queued frame with the newest one, no tearing and no waiting. Falls back to immediate, then fifo
+    TS_PRESENT_MODE_MAILBOX = 1,
+
+    /// \brief present right away, may tear. Falls back to mailbox, then fifo
+    TS_PRESENT_MODE_IMMEDIATE = 2,
+
+    /// \brief like fifo, but late frames are presented right away and may tear. Falls back to fifo
+    TS_PRESENT_MODE_FIFO_RELAXED = 3
+} TS_PresentMode;
+
 /// \brief add a rigid, axis-aligned collision box to the state
 /// \param id: id of the newly created object
 /// \param size_x: size along the x-dimension
@@ -152,6 +195,164 @@ void TS_VkCmdDrawSprite(
     float scale_x, float scale_y
 );
 
+/// \brief look up the texture handle of an image, loading the image in the background on first use.
+/// Drawing with the handle skips the path lookup TS_VkCmdDrawSprite does on every call
+/// \param image_path: path to image on disk
+/// \returns texture handle, valid until TS_VkUnloadTexture is called for the path
+int TS_VkRegisterTexture(const char * image_path);
+
+/// \brief draw a sprite using a texture handle, see TS_VkCmdDrawSprite
+/// \param texture: handle returned by TS_VkRegisterTexture, nothing is drawn while it is not resident
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param alpha: transparency component of the color (in RGBA)
+/// \param region_x: x-coordinate of the top left corner of the subregion
+/// \param region_y: y-coordinate of the top left corner of the subregion
+/// \param region_width: size of the subregion along the x-dimension
+/// \param region_height: size of the subregion along the x-dimension
+/// \param cell_w: width of each cell of the grid
+/// \param cell_h: height of each cell of the grid
+/// \param cell_index_i: x-index of the cell
+/// \param cell_index_j: y-index of the cell
+/// \param position_x: x-coordinate of the top left corner of the sprite
+/// \param position_y: y-coordinate of the top left corner of the sprite
+/// \param scale_x: scale along the x-dimension
+/// \param scale_y: scale along the y-dimension
+void TS_VkCmdDrawSpriteH(
+    int texture,
+    float r, float g, float b, float alpha,
+    int region_x, int region_y, int region_width, int region_height,
+    int cell_w, int cell_h, int cell_index_i, int cell_index_j,
+    float position_x, float position_y,
+    float scale_x, float scale_y
+);
+
+/// \brief create a static batch, geometry that is uploaded to gpu memory once and then drawn by reference
+/// each frame, e.g. the background tiles of a level. Replaces any static batch previously created with the same id
+/// \param batch: id of the static batch
+void TS_VkCreateStaticBatch(int batch);
+
+/// \brief destroy a static batch
+/// \param batch: id of the static batch
+void TS_VkDestroyStaticBatch(int batch);
+
+/// \brief add a rectangle to a static batch, see TS_VkCmdDrawRect. The batch is uploaded again
+/// the next time a frame is drawn, so add all quads at once rather than a few each frame
+/// \param batch: id of the static batch
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param alpha: transparency component of the color (in RGBA)
+/// \param x: x-position of the upper left corner of the rectangle
+/// \param y: y-position of the upper left corner of the rectangle
+/// \param width: size along the x-dimension
+/// \param height: size along the y-dimension
+void TS_VkStaticBatchAddRect(
+    int batch,
+    float r, float g, float b, float alpha,
+    float x, float y,
+    float width, float height
+);
+
+/// \brief add a sprite to a static batch, see TS_VkCmdDrawSpriteH. The batch is not uploaded until all
+/// of its textures are resident, and the textures must stay loaded for as long as the batch is drawn.
+/// Sprites whose texture fails to load, or is unloaded before the batch is uploaded, are dropped from it
+/// \param batch: id of the static batch
+/// \param texture: handle returned by TS_VkRegisterTexture
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param alpha: transparency component of the color (in RGBA)
+/// \param region_x: x-coordinate of the top left corner of the subregion
+/// \param region_y: y-coordinate of the top left corner of the subregion
+/// \param region_width: size of the subregion along the x-dimension
+/// \param region_height: size of the subregion along the x-dimension
+/// \param cell_w: width of each cell of the grid
+/// \param cell_h: height of each cell of the grid
+/// \param cell_index_i: x-index of the cell
+/// \param cell_index_j: y-index of the cell
+/// \param position_x: x-coordinate of the top left corner of the sprite
+/// \param position_y: y-coordinate of the top left corner of the sprite
+/// \param scale_x: scale along the x-dimension
+/// \param scale_y: scale along the y-dimension
+void TS_VkStaticBatchAddSprite(
+    int batch,
+    int texture,
+    float r, float g, float b, float alpha,
+    int region_x, int region_y, int region_width, int region_height,
+    int cell_w, int cell_h, int cell_index_i, int cell_index_j,
+    float position_x, float position_y,
+    float scale_x, float scale_y
+);
+
+/// \brief draw a static batch with the current blend mode and layer. Its quads are drawn in the order they
+/// were added, in one draw call, and nothing is uploaded unless quads were added since the last frame
+/// \param batch: id of the static batch
+/// \param x: offset along the x-dimension, in pixels
+/// \param y: offset along the y-dimension, in pixels
+void TS_VkDrawStaticBatch(int batch, float x, float y);
+
+/// \brief create a tilemap, a grid of tiles drawn with a single quad no matter how many tiles it has.
+/// All tiles start out empty. Replaces any tilemap previously created with the same id, at most 16 may exist at once
+/// \param tilemap: id of the tilemap
+/// \param width: number of tiles along the x-dimension
+/// \param height: number of tiles along the y-dimension
+/// \param tileset: handle returned by TS_VkRegisterTexture, the image the tiles are cut from
+/// \param tile_width: width of a tile in the tileset, in pixels
+/// \param tile_height: height of a tile in the tileset, in pixels
+void TS_VkCreateTilemap(int tilemap, int width, int height, int tileset, int tile_width, int tile_height);
+
+/// \brief destroy a tilemap
+/// \param tilemap: id of the tilemap
+void TS_VkDestroyTilemap(int tilemap);
+
+/// \brief set a tile of a tilemap
+/// \param tilemap: id of the tilemap
+/// \param x: x-index of the tile
+/// \param y: y-index of the tile
+/// \param tile: index of the tile in the tileset, counting left to right and top to bottom, -1 for an empty tile
+void TS_VkSetTile(int tilemap, int x, int y, int tile);
+
+/// \brief set a rectangle of tiles of a tilemap, see TS_VkSetTile
+/// \param tilemap: id of the tilemap
+/// \param x: x-index of the top left tile
+/// \param y: y-index of the top left tile
+/// \param width: number of tiles along the x-dimension
+/// \param height: number of tiles along the y-dimension
+/// \param tiles: width * height tile indices, row by row
+void TS_VkSetTiles(int tilemap, int x, int y, int width, int height, const int * tiles);
+
+/// \brief draw a tilemap with the current blend mode and layer, nothing is drawn while its tileset is not resident
+/// \param tilemap: id of the tilemap
+/// \param r: red component of the color (in RGBA)
+/// \param g: green component of the color (in RGBA)
+/// \param b: blue component of the color (in RGBA)
+/// \param alpha: transparency component of the color (in RGBA)
+/// \param x: x-coordinate of the top left corner of the map
+/// \param y: y-coordinate of the top left corner of the map
+/// \param scale_x: scale along the x-dimension, negative to mirror the map to the left of x
+/// \param scale_y: scale along the y-dimension, negative to mirror the map above y
+void TS_VkDrawTilemap(int tilemap, float r, float g, float b, float alpha, float x, float y, float scale_x, float scale_y);
+
+/// \brief called once a texture loaded with TS_VkLoadTextureAsync is ready to be drawn
+/// \param image_path: path to image on disk
+/// \param texture_index: handle of the texture, -1 if it failed to load
+/// \param user_data: pointer supplied to TS_VkLoadTextureAsync
+typedef void (*TS_TextureReadyCallback)(const char * image_path, int texture_index, void * user_data);
+
+/// \brief load a texture on a background thread, without blocking the caller on disk I/O or decoding
+/// \param image_path: path to image on disk
+/// \param callback: called on the render thread once the texture is ready, may be NULL
+/// \param user_data: passed to callback, may be NULL
+/// \returns texture handle. If loading fails the handle is never resident and the image is not loaded again until it is unloaded
+int TS_VkLoadTextureAsync(const char * image_path, TS_TextureReadyCallback callback, void * user_data);
+
+/// \brief check whether a texture has finished loading
+/// \param texture_index: handle returned by TS_VkLoadTextureAsync
+/// \returns true if the texture is ready to be drawn, false once it was unloaded
+bool TS_VkIsTextureResident(int texture_index);
+
 /// \brief clear the render window with a color
 /// \param r: red component of the color (in RGBA)
 /// \param g: green component of the color (in RGBA)
@@ -159,6 +360,103 @@ void TS_VkCmdDrawSprite(
 /// \param alpha: transparency component of the color (in RGBA)
 void TS_VkCmdClearColorImage(float r, float g, float b, float alpha);
 
+/// \brief set the number of frames the cpu may record ahead of the gpu. Call before TS_Init
+/// \param n: number of frames in flight, clamped to [1, 3]. 2 by default
+void TS_VkSetFramesInFlight(int n);
+
+/// \brief request the gpu to render with, instead of the best one found. Call before TS_Init.
+/// The TELESCOPE_DEVICE environment variable takes precedence. Unusable or unknown devices are ignored with a warning
+/// \param name_or_uuid: device uuid, or case-insensitive part of the device name, e.g. "nvidia". Null or empty to select automatically
+void TS_VkSetPhysicalDevice(const char * name_or_uuid);
+
+/// \brief get the name of the gpu being rendered with
+/// \returns device name, empty before TS_Init
+const char * TS_VkGetPhysicalDeviceName();
+
+/// \brief set how frames are presented, e.g. mailbox or immediate to measure frame times without vsync.
+/// May be called at any time, the swapchain is recreated before the next frame
+/// \param mode: requested present mode, TS_PRESENT_MODE_FIFO by default. Unsupported modes fall back, see TS_PresentMode
+void TS_VkSetPresentMode(TS_PresentMode mode);
+
+/// \brief get the present mode in use, which differs from the requested one if it fell back
+/// \returns present mode of the swapchain
+TS_PresentMode TS_VkGetPresentMode();
+
+/// \brief set the layout vertices are packed into when uploaded. Call before TS_Init
+/// \param format: vertex format, TS_VERTEX_FORMAT_FLOAT by default and for unknown values
+void TS_VkSetVertexFormat(TS_VertexFormat format);
+
+/// \brief draw quads as triangle fans with a primitive restart index after each, instead of
+/// triangle lists sharing a static index buffer. Call before TS_Init
+/// \param enabled: true to draw triangle fans, false by default
+void TS_VkSetTriangleFans(bool enabled);
+
+/// \brief draw every rect and sprite as a single 32 byte instance expanded by the vertex shader,
+/// instead of four vertices. Applies to the rects and sprites drawn after the call, the two kinds may be mixed within a frame
+/// \param enabled: true to draw instanced, false by default
+void TS_VkSetInstancedDrawing(bool enabled);
+
+/// \brief watch a directory for edits to the shaders, and rebuild the pipelines at the start of the
+/// next frame once an edited shader compiles. Compile errors are printed and the last working shader is kept
+/// \param shader_dir: directory containing the files in shaders/, NULL to stop watching
+void TS_VkSetShaderHotReload(const char * shader_dir);
+
+/// \brief set the blend mode of the rects and sprites drawn after this call. Consecutive quads with the
+/// same blend mode are drawn together, so grouping draws by blend mode keeps the number of draw calls low
+/// \param mode: blend mode, TS_BLEND_MODE_ALPHA by default
+void TS_VkSetBlendMode(TS_BlendMode mode);
+
+/// \brief set the layer of the rects and sprites drawn after this call. Higher layers are drawn over
+/// lower ones regardless of the order of the draw calls, within a layer later draws are on top
+/// \param layer: layer, 0 by default
+void TS_VkSetLayer(int layer);
+
+/// \brief create a spatial hash, a grid of buckets for finding the rectangles that overlap an area, e.g. the
+/// tiles of a scrolling tilemap inside the camera. Replaces any spatial hash previously created with the same id
+/// \param hash: id of the spatial hash
+/// \param cell_size: size of the grid cells, ideally close to the size of the typical rectangle
+void TS_SpatialHashCreate(int hash, float cell_size);
+
+/// \brief destroy a spatial hash
+/// \param hash: id of the spatial hash
+void TS_SpatialHashDestroy(int hash);
+
+/// \brief insert a rectangle into a spatial hash, replacing any rectangle previously inserted with the same id
+/// \param hash: id of the spatial hash
+/// \param id: id returned by queries overlapping the rectangle
+/// \param x: x-coordinate of the top left corner
+/// \param y: y-coordinate of the top left corner
+/// \param w: size in x-dimension
+/// \param h: size in y-dimension. Rectangles with a nan or infinite coordinate or size are ignored
+void TS_SpatialHashInsert(int hash, int id, float x, float y, float w, float h);
+
+/// \brief remove a rectangle from a spatial hash
+/// \param hash: id of the spatial hash
+/// \param id: id of the rectangle
+void TS_SpatialHashRemove(int hash, int id);
+
+/// \brief remove all rectangles from a spatial hash
+/// \param hash: id of the spatial hash
+void TS_SpatialHashClear(int hash);
+
+/// \brief find the rectangles of a spatial hash that overlap an area, e.g. the visible part of the screen
+/// \param hash: id of the spatial hash
+/// \param x: x-coordinate of the top left corner of the area
+/// \param y: y-coordinate of the top left corner of the area
+/// \param w: size of the area in x-dimension
+/// \param h: size of the area in y-dimension
+/// \param ids: receives the ids of up to max_ids rectangles, in no particular order
+/// \param max_ids: capacity of ids
+/// \returns number of overlapping rectangles, if larger than max_ids only the first max_ids were written
+int TS_SpatialHashQuery(int hash, float x, float y, float w, float h, int * ids, int max_ids);
+
+/// \brief get statistics about the vertex and index streams
+/// \returns TS_StreamStats object, describing per-frame usage and capacity in bytes
+struct TS_StreamStats TS_VkGetStreamStats();
+
+/// \brief reset the high-water marks and grow counter of the stream statistics
+void TS_VkResetStreamStats();
+
 /// \brief start the drawing pass
 void TS_VkBeginDrawPass();
 
@@ -169,12 +467,57 @@ void TS_VkBeginDrawPass();
 /// \param alpha: transparency component of the color (in RGBA)
 void TS_VkEndDrawPass(float r, float g, float b, float a);
 
+/// \brief copy the frame being drawn back to host memory, call between TS_VkBeginDrawPass and TS_VkEndDrawPass.
+/// The copy completes a frame or two later, without stalling the gpu
+/// \param pixels: receives width * height RGBA pixels, see TS_VkGetFrameSize. Must stay valid until the readback is complete
+/// \returns ticket of the readback, -1 if the swapchain images cannot be copied from
+int TS_VkReadbackFrame(void * pixels);
+
+/// \brief check whether a readback has been written to its pixels
+/// \param ticket: ticket returned by TS_VkReadbackFrame
+/// \returns true if the pixels are ready
+bool TS_VkIsReadbackComplete(int ticket);
+
+/// \brief block until a readback has been written to its pixels, returns immediately if its frame has not been submitted yet
+/// \param ticket: ticket returned by TS_VkReadbackFrame
+void TS_VkWaitReadback(int ticket);
+
+/// \brief get the size of the frames being rendered, which readbacks copy
+/// \param width: receives the width, in pixels
+/// \param height: receives the height, in pixels
+void TS_VkGetFrameSize(int * width, int * height);
+
+/// \brief save the frame being drawn as a png, call between TS_VkBeginDrawPass and TS_VkEndDrawPass.
+/// The frame is copied back a frame or two later and encoded on a worker thread, so nothing stalls
+/// \param path: png file to write
+/// \returns ticket of the readback, -1 if the swapchain images cannot be copied from
+int TS_VkCaptureFrame(const char * path);
+
+/// \brief capture every frame from now on, e.g. to record a video of a session.
+/// Frames are written to path_prefix followed by a six digit frame number and .png
+/// \param path_prefix: directory and start of the file names, e.g. "captures/frame_"
+/// \returns false if the swapchain images cannot be copied from
+bool TS_VkStartCapture(const char * path_prefix);
+
+/// \brief stop capturing every frame, frames already captured are still written
+/// \returns number of frames skipped because the png encoder could not keep up
+uint64_t TS_VkStopCapture();
+
+/// \brief block until all captures of submitted frames have been written
+void TS_VkFlushCaptures();
+
 /// \brief initialize the state
 /// \param title: title of the window
 /// \param width: width of the window, in pixels
 /// \param height: height of the window, in pixels
 void TS_Init(const char * title, int width, int height);
 
+/// \brief initialize the state without a window or audio, rendering into offscreen images,
+/// e.g. for tests or servers. Read frames back with TS_VkReadbackFrame
+/// \param width: width of the frames, in pixels
+/// \param height: height of the frames, in pixels
+void TS_InitHeadless(int width, int height);
+
 /// \brief shutdown the state
 void TS_Quit();
 
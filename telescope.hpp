@@ -7,6 +7,8 @@
 #include <include/bullet_interface.hpp>
 #include <include/physics_object.hpp>
 #include <include/vertex.hpp>
+#include <include/render_stats.hpp>
+#include <include/spatial_hash.hpp>
 #include <include/vulkan_interface.hpp>
 
 